@@ -0,0 +1,182 @@
+// Scene benchmark for main.exe, run from HW1 by make bench.
+//
+//    ./bench.exe [-n <runs>] [-- <extra main.exe options>]
+//
+// Every scene is rendered runs times at a fixed size. The harness reports
+// the median and p95 wall time, camera Mrays/s at the median and the peak
+// RSS of the renderer, then checks the last image against a stored
+// reference, the last frame for an animation. A render that takes longer
+// than ten minutes is killed. The exit status is 1 if a render failed or an
+// image fell below its PSNR threshold.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <algorithm>
+#include <vector>
+#define STB_IMAGE_IMPLEMENTATION
+#include "../external/stb_image.h"
+
+struct BenchScene {
+   const char* name;
+   const char* input;
+   int w, h;
+   // Animation file, NULL for a still image. Its frames are rendered
+   // frameParallel at a time with --frame-parallel.
+   const char* animation;
+   int frames, frameParallel;
+   // Traced with --packet, for scenes whose reference was rendered scalar
+   bool packet;
+   // Image the render is compared with, and the lowest PSNR (dB) accepted
+   const char* reference;
+   double minPSNR;
+};
+
+// pianoroom is checked against the output of the original tracer, the rest
+// against renders of this tree saved when the benchmark was added (the
+// animation rendered one frame at a time, the instances with --scalar)
+static const BenchScene scenes[] = {
+   {"globe", "inputs/globe.ray", 500, 500, NULL, 1, 1, false, "bench/reference/globe.png", 30.},
+   {"elephant", "inputs/elephant.ray", 500, 500, NULL, 1, 1, false, "bench/reference/elephant.png", 30.},
+   {"realelephant", "inputs/realelephant.ray", 500, 500, NULL, 1, 1, false, "bench/reference/realelephant.png", 30.},
+   {"pianoroom", "inputs/pianoroom.ray", 500, 500, NULL, 1, 1, false, "original/pianoroom.ppm", 30.},
+   {"instances", "inputs/instances.ray", 500, 500, NULL, 1, 1, true, "bench/reference/instances.png", 30.},
+   {"elephant-anim", "inputs/elephant.ray", 500, 500, "inputs/elephant.animate", 24, 4, false, "bench/reference/elephant-animated.png", 30.},
+};
+
+static double now() {
+   struct timespec t;
+   clock_gettime(CLOCK_MONOTONIC, &t);
+   return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+// Runs main.exe once with its output silenced. Fills in the wall time and
+// peak RSS (KiB), returns false if it did not exit with status 0.
+static bool render(const BenchScene& s, const char* out, int extraArgc, char** extraArgv, double* seconds, long* rss) {
+   char w[16], h[16], frames[16], frameParallel[16];
+   snprintf(w, sizeof(w), "%d", s.w);
+   snprintf(h, sizeof(h), "%d", s.h);
+   std::vector<const char*> args = {"./main.exe", "-i", s.input, "-W", w, "-H", h, "--ppm", "-o", out};
+   if (s.packet) args.push_back("--packet");
+   if (s.animation) {
+      snprintf(frames, sizeof(frames), "%d", s.frames);
+      snprintf(frameParallel, sizeof(frameParallel), "%d", s.frameParallel);
+      args.insert(args.end(), {"-a", s.animation, "-F", frames, "--frame-parallel", frameParallel, "--no-movie"});
+   }
+   for (int i = 0; i < extraArgc; i++) args.push_back(extraArgv[i]);
+   args.push_back(NULL);
+
+   const double start = now();
+   const pid_t pid = fork();
+   if (pid < 0) {
+      printf("Could not fork\n");
+      exit(1);
+   }
+   if (pid == 0) {
+      const int devnull = open("/dev/null", O_WRONLY);
+      dup2(devnull, 1);
+      // Survives execv, so a hung render dies of SIGALRM
+      alarm(600);
+      execv(args[0], (char* const*)&args[0]);
+      _exit(127);
+   }
+   int status;
+   struct rusage usage;
+   if (wait4(pid, &status, 0, &usage) < 0) {
+      printf("Could not wait for %s\n", args[0]);
+      exit(1);
+   }
+   *seconds = now() - start;
+   *rss = usage.ru_maxrss;
+   return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+// PSNR of a against b over RGB, -1 if either cannot be read or the sizes
+// differ. Identical images give INFINITY.
+static double psnr(const char* a, const char* b) {
+   int aw, ah, bw, bh, n;
+   unsigned char* pa = stbi_load(a, &aw, &ah, &n, 3);
+   unsigned char* pb = stbi_load(b, &bw, &bh, &n, 3);
+   double result = -1;
+   if (pa && pb && aw == bw && ah == bh) {
+      double sum = 0;
+      for (long i = 0; i < 3L * aw * ah; i++) {
+         const double d = (double)pa[i] - pb[i];
+         sum += d * d;
+      }
+      const double mse = sum / (3. * aw * ah);
+      result = (mse == 0) ? INFINITY : 10 * log10(255. * 255. / mse);
+   }
+   stbi_image_free(pa);
+   stbi_image_free(pb);
+   return result;
+}
+
+int main(int argc, char** argv) {
+   int runs = 5;
+   int extraArgc = 0;
+   char** extraArgv = NULL;
+   for (int i = 1; i < argc; i++) {
+      if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+         runs = atoi(argv[++i]);
+         if (runs < 1) {
+            printf("Error -n option must be followed by a positive number of runs\n");
+            return 1;
+         }
+      } else if (strcmp(argv[i], "--") == 0) {
+         extraArgc = argc - i - 1;
+         extraArgv = &argv[i + 1];
+         break;
+      } else {
+         printf("Usage %s [-n <runs>] [-- <main.exe options>]\n", argv[0]);
+         return 1;
+      }
+   }
+
+   bool ok = true;
+   printf("%-13s %9s %9s %9s %9s %8s  %s\n", "scene", "size", "median s", "p95 s", "Mrays/s", "RSS MiB", "PSNR dB");
+   for (const BenchScene& s : scenes) {
+      // main.exe writes the frames of an animation to <out>.tmp.<frame>.ppm
+      char out[256], image[300];
+      if (s.animation) {
+         snprintf(out, sizeof(out), "output/bench-%s", s.name);
+         snprintf(image, sizeof(image), "%s.tmp.%07d.ppm", out, s.frames - 1);
+      } else {
+         snprintf(out, sizeof(out), "output/bench-%s.ppm", s.name);
+         snprintf(image, sizeof(image), "%s", out);
+      }
+      std::vector<double> times;
+      long peak = 0;
+      bool rendered = true;
+      for (int r = 0; r < runs && rendered; r++) {
+         double seconds;
+         long rss;
+         rendered = render(s, out, extraArgc, extraArgv, &seconds, &rss);
+         times.push_back(seconds);
+         if (rss > peak) peak = rss;
+      }
+      if (!rendered) {
+         printf("%-13s render failed\n", s.name);
+         ok = false;
+         continue;
+      }
+      std::sort(times.begin(), times.end());
+      const double median = times[times.size() / 2];
+      // Nearest rank
+      const double p95 = times[(size_t)ceil(.95 * times.size()) - 1];
+      const double quality = psnr(image, s.reference);
+      const bool pass = quality >= s.minPSNR;
+      ok &= pass;
+      char size[32];
+      snprintf(size, sizeof(size), "%dx%d", s.w, s.h);
+      printf("%-13s %9s %9.3f %9.3f %9.2f %8.1f  ", s.name, size, median, p95, (double)s.w * s.h * s.frames / median * 1e-6, peak / 1024.);
+      if (quality < 0) printf("could not compare with %s FAIL\n", s.reference);
+      else printf("%.2f (min %.0f) %s\n", quality, s.minPSNR, pass ? "ok" : "FAIL");
+   }
+   return ok ? 0 : 1;
+}
@@ -7,15 +7,40 @@
 #include "src/box.h"
 #include "src/disk.h"
 #include "src/triangle.h"
+#include "src/mesh.h"
+#include "src/instance.h"
+#include "src/meshcache.h"
+#include "src/tiles.h"
+#include "src/alloccount.h"
+#include "src/bvh.h"
+#include "src/packet.h"
+#include "src/framewriter.h"
+#include "src/animation.h"
+#include "src/hitcache.h"
+#include "src/shadowcache.h"
+#include "src/skycube.h"
+#include "src/antialias.h"
+#include "src/stats.h"
+#include "src/scenereader.h"
+#include "src/server.h"
+#include "src/imageencoder.h"
 #include "src/Textures/imagetexture.h"
 #include "src/Textures/colortexture.h"
 #include<stdio.h>
 #include<stdlib.h>
 #include <string.h>
 #include <iostream>
+#include <omp.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "external/stb_image_write.h"
 using namespace std;
 
 #include <sys/time.h>
+#include <signal.h>
+#include <unistd.h>
 
 __attribute__((always_inline))
 constexpr inline float tdiff(struct timeval *start, struct timeval *end) {
@@ -33,88 +58,402 @@ unsigned char* getColor(unsigned char a, unsigned char b, unsigned char c){
      
 int W = 1000, H = 1000;
 
-unsigned char* DATA = (unsigned char*)malloc(W*H*3*sizeof(unsigned char));
+// OPTIM: trace primary rays in SIMD packets over small pixel tiles
+bool packetMode = false;
+// Progressive mode: dump the frame in progress every progressInterval seconds
+const char* progressFile = NULL;
+double progressInterval = 1.;
+// Heap allocations made while tracing, expected to stay at zero
+std::atomic<unsigned long long> renderAllocs(0);
+// Frames rendered at the same time, each on its own copy of the scene
+int frameParallel = 1;
+// Reuse primary hits from the previous frame where nothing moved
+bool reuseHits = false;
+// Grid cell size of the shadow cache, 0 when shadows are always traced
+double shadowCell = 0;
+// Pick mip levels by ray footprint instead of point sampling textures
+bool filterTextures = false;
+// Camera rays per pixel a frame may use on average with --aa, 0 for exactly one
+double aaBudget = 0;
+// JSON lines written per frame with --stats, NULL without
+const char* statsFile = NULL;
+// --serve socket path ("-" for stdin / stdout), NULL to render and exit
+const char* serveFile = NULL;
 
-__attribute__((always_inline))
-inline unsigned char get(int i, int j, int k){
-   return DATA[3*(i+j*W)+k]; 
-}
-__attribute__((always_inline))
-inline unsigned char* getPos(int i, int j){
-   return &DATA[3*(i+j*W)]; 
+void outputPPM(const char* file, const unsigned char* data);
+
+// Trace the tile at (x0, y0) into buf, a packed tw x th RGB image. The shape
+// each primary ray hit goes to ids unless it is NULL.
+void renderTile(Autonoma* c, int x0, int y0, int tw, int th, unsigned char* buf, Shape** ids){
+   // OPTIM dereference once
+   auto camera = c->camera;
+   auto up = camera.up;
+   auto forward = camera.forward;
+   auto right = camera.right;
+   auto focus = camera.focus;
+
+   HitCache* cache = c->hitCache;
+
+   if (!packetMode) {
+      for(int j = y0; j<y0+th; ++j)
+         for(int i = x0; i<x0+tw; ++i){
+            Vector ra = forward+((double)i/W-.5)*((right))+(.5-(double)j/H)*((up));
+            Ray ray(focus, ra);
+            double time;
+            Shape* shape;
+            unsigned int prim;
+            if (!(cache && cache->lookup(i+j*W, ray, &shape, &time, &prim))) {
+               shape = c->bvh->intersect(ray, &time, &prim);
+               if (cache) cache->store(i+j*W, shape, time, prim);
+            }
+            if (ids) ids[i+j*W] = shape;
+            calcHitColor(&buf[3*((i-x0)+(j-y0)*tw)], c, ray, shape, time, prim, 0);
+         }
+      return;
+   }
+
+   for(int py = y0; py<y0+th; py += PACKET_TILE_H)
+      for(int px = x0; px<x0+tw; px += PACKET_TILE_W){
+         int pixel[PACKET_WIDTH], image[PACKET_WIDTH];
+         RayPacket p;
+         p.n = 0;
+         for(int k = 0; k<PACKET_WIDTH; ++k){
+            const int i = px+k%PACKET_TILE_W, j = py+k/PACKET_TILE_W;
+            if(i>=x0+tw || j>=y0+th) continue;
+            Vector ra = forward+((double)i/W-.5)*((right))+(.5-(double)j/H)*((up));
+            pixel[p.n] = (i-x0)+(j-y0)*tw;
+            image[p.n] = i+j*W;
+            p.ox[p.n] = focus.x; p.oy[p.n] = focus.y; p.oz[p.n] = focus.z;
+            p.dx[p.n] = ra.x; p.dy[p.n] = ra.y; p.dz[p.n] = ra.z;
+            p.n++;
+         }
+         for(int k = p.n; k<PACKET_WIDTH; ++k){
+            p.ox[k] = p.ox[0]; p.oy[k] = p.oy[0]; p.oz[k] = p.oz[0];
+            p.dx[k] = p.dx[0]; p.dy[k] = p.dy[0]; p.dz[k] = p.dz[0];
+         }
+         double time[PACKET_WIDTH];
+         Shape* shape[PACKET_WIDTH];
+         unsigned int prim[PACKET_WIDTH];
+         // The packet is only traced if some lane lost its cached hit
+         bool cached = cache != NULL;
+         for(int k = 0; k<p.n && cached; ++k)
+            cached = cache->lookup(image[k], Ray(focus, Vector(p.dx[k], p.dy[k], p.dz[k])), &shape[k], &time[k], &prim[k]);
+         if (!cached) {
+            intersectPacket(c->bvh, p, time, shape, prim);
+            if (cache)
+               for(int k = 0; k<p.n; ++k) cache->store(image[k], shape[k], time[k], prim[k]);
+         }
+         if (ids)
+            for(int k = 0; k<p.n; ++k) ids[image[k]] = shape[k];
+         // Shading and all secondary rays stay scalar
+         for(int k = 0; k<p.n; ++k)
+            calcHitColor(&buf[3*pixel[k]], c, Ray(focus, Vector(p.dx[k], p.dy[k], p.dz[k])), shape[k], time[k], prim[k], 0);
+      }
 }
-void set(int i, int j, unsigned char r, unsigned char g, unsigned char b){
-   DATA[3*(i+j*W)] = r; 
-   DATA[3*(i+j*W)+1] = g; 
-   DATA[3*(i+j*W)+2] = b; 
+
+// OPTIM: body(worker, numWorkers) on up to workers threads, returning the
+// sum of what each returns. A single worker runs inline, as libgomp
+// allocates a fresh team for every one thread parallel region.
+template <typename Body>
+unsigned long long runWorkers(int workers, Body body){
+   if (workers <= 1) return body(0, 1);
+   unsigned long long sum = 0;
+   #pragma omp parallel num_threads(workers) reduction(+:sum)
+   sum += body(omp_get_thread_num(), omp_get_num_threads());
+   return sum;
 }
 
-void refresh(Autonoma* c){
-   // OPTIM dereference once
+// Second pass of --aa over a finished frame, ids holding the shape each
+// pixel's ray hit. Returns the camera rays it added.
+unsigned long long refineEdges(Autonoma* c, unsigned char* data, int workers, TileScheduler* scheduler, Shape** ids, unsigned char* edges, RayStats* counters){
+   // Even bands of rows, a work sharing loop would allocate in nested teams
+   const unsigned long long edgeCount = runWorkers(workers, [&](int worker, int n) -> unsigned long long {
+      return findEdges(data, ids, edges, W, H, H*worker/n, H*(worker+1)/n);
+   });
+   if (edgeCount == 0) return 0;
+   // Extra rays per edge pixel, a fractional share is met on average by
+   // giving each pixel the rounding up with that probability
+   double share = (aaBudget-1)*W*H/edgeCount;
+   if (share > AA_MAX_SAMPLES-1) share = AA_MAX_SAMPLES-1;
+
    auto camera = c->camera;
    auto up = camera.up;
    auto forward = camera.forward;
    auto right = camera.right;
    auto focus = camera.focus;
+   const int tilesX = (W + TILE_SIZE - 1) / TILE_SIZE;
+   const int tilesY = (H + TILE_SIZE - 1) / TILE_SIZE;
+   scheduler->reset(tilesX*tilesY);
+   return runWorkers(workers, [&](int worker, int numWorkers) -> unsigned long long {
+      unsigned long long traced = 0;
+      int t;
+      while((t = scheduler->next(worker)) >= 0){
+         const int x0 = (t%tilesX)*TILE_SIZE, y0 = (t/tilesX)*TILE_SIZE;
+         const int x1 = (x0+TILE_SIZE <= W) ? x0+TILE_SIZE : W;
+         const int y1 = (y0+TILE_SIZE <= H) ? y0+TILE_SIZE : H;
+         for(int j = y0; j<y1; ++j)
+            for(int i = x0; i<x1; ++i){
+               const int pixel = i+j*W;
+               if (!edges[pixel]) continue;
+               const int n = (int)(share + ((unsigned int)pixel*0x9E3779B1u >> 8)*(1./(1<<24)));
+               if (n == 0) continue;
+               unsigned char* out = &data[3*pixel];
+               int sum[3] = {out[0], out[1], out[2]};
+               for(int k = 1; k<=n; ++k){
+                  double dx, dy;
+                  aaOffset(pixel, k, &dx, &dy);
+                  Vector ra = forward+((i+dx)/W-.5)*((right))+(.5-(j+dy)/H)*((up));
+                  Ray ray(focus, ra);
+                  double time;
+                  unsigned int prim;
+                  Shape* shape = c->bvh->intersect(ray, &time, &prim);
+                  unsigned char color[3];
+                  calcHitColor(color, c, ray, shape, time, prim, 0);
+                  sum[0] += color[0]; sum[1] += color[1]; sum[2] += color[2];
+               }
+               out[0] = (unsigned char)((sum[0]+(n+1)/2)/(n+1));
+               out[1] = (unsigned char)((sum[1]+(n+1)/2)/(n+1));
+               out[2] = (unsigned char)((sum[2]+(n+1)/2)/(n+1));
+               traced += n;
+            }
+      }
+      if (counters) flushStats(counters);
+      return traced;
+   });
+}
+
+// --progressive state of one thread rendering frames. Worker 0 copies only
+// tiles marked done into its own snapshot, so it never reads pixels another
+// worker is still writing. Tiles not finished yet show whatever the snapshot
+// held before (black, or an earlier frame).
+struct ProgressDump {
+   std::atomic<bool>* done;
+   // Touched by worker 0 only
+   bool* copied;
+   unsigned char* snapshot;
+   char tmpPath[1100];
+
+   ProgressDump(int numTiles) {
+      static std::atomic<int> dumps(0);
+      done = new std::atomic<bool>[numTiles];
+      copied = (bool*)malloc(numTiles * sizeof(bool));
+      snapshot = (unsigned char*)calloc(W*H*3, sizeof(unsigned char));
+      snprintf(tmpPath, sizeof(tmpPath), "%s.tmp.%d.%d", progressFile, (int)getpid(), dumps++);
+   }
+
+   void reset(int numTiles) {
+      for (int t = 0; t < numTiles; t++) {
+         done[t].store(false, std::memory_order_relaxed);
+         copied[t] = false;
+      }
+   }
+
+   // Writes the finished tiles of data to a temporary next to progressFile
+   // and renames it over progressFile, so a previewer never sees half a file
+   void write(const unsigned char* data, int numTiles, int tilesX) {
+      for (int t = 0; t < numTiles; t++) {
+         if (copied[t] || !done[t].load(std::memory_order_acquire)) continue;
+         const int x0 = (t%tilesX)*TILE_SIZE, y0 = (t/tilesX)*TILE_SIZE;
+         const int tw = (x0+TILE_SIZE <= W) ? TILE_SIZE : W-x0;
+         const int th = (y0+TILE_SIZE <= H) ? TILE_SIZE : H-y0;
+         for(int j = 0; j<th; ++j)
+            memcpy(&snapshot[3*(x0+(y0+j)*W)], &data[3*(x0+(y0+j)*W)], 3*tw);
+         copied[t] = true;
+      }
+      outputPPM(tmpPath, snapshot);
+      if (rename(tmpPath, progressFile) != 0) remove(tmpPath);
+   }
+};
 
-   int n = 0;
-   #pragma omp parallel for schedule(dynamic)
-   for(n = 0; n<H*W; ++n) 
-   { 
-      Vector ra = forward+((double)(n%W)/W-.5)*((right))+(.5-(double)(n/W)/H)*((up));
-      calcColor(&DATA[3*n], c, Ray(focus, ra), 0);
+// OPTIM: TILE_SIZE square tiles handed out by a work-stealing scheduler
+// instead of a dynamic schedule over single pixels. Renders c into data with
+// workers threads, returns the camera rays traced. ids and edges are W*H
+// scratch buffers for --aa, NULL without it. Each thread's counters go to
+// counters unless it is NULL.
+unsigned long long refresh(Autonoma* c, unsigned char* data, int workers, Shape** ids, unsigned char* edges, RayStats* counters){
+   const int tilesX = (W + TILE_SIZE - 1) / TILE_SIZE;
+   const int tilesY = (H + TILE_SIZE - 1) / TILE_SIZE;
+   // OPTIM: reused across frames so a frame never touches the heap, one set
+   // per thread rendering frames. Copied to locals since the pixel threads
+   // each see their own thread_local.
+   static thread_local TileScheduler* frameScheduler = NULL;
+   static thread_local ProgressDump* frameProgress = NULL;
+   if (!frameScheduler) {
+      // Set up on the thread's first frame, which may overlap another
+      // thread's frame, so not counted as rendering
+      UncountedAllocs uncounted;
+      frameScheduler = new TileScheduler(workers);
+      if (progressFile) frameProgress = new ProgressDump(tilesX*tilesY);
+      // The first parallel region starts libgomp's threads
+      runWorkers(workers, [](int worker, int numWorkers) -> unsigned long long { return 0; });
    }
+   TileScheduler* scheduler = frameScheduler;
+   ProgressDump* progress = frameProgress;
+   scheduler->reset(tilesX*tilesY);
+   if (progress) progress->reset(tilesX*tilesY);
+   if (c->hitCache) c->hitCache->beginFrame(c);
+   if (c->shadowCache) c->shadowCache->beginFrame(c);
+   if (filterTextures) {
+      // Neighbouring primary rays are right/W and up/H apart at distance forward
+      const double sx = c->camera.right.mag()/W, sy = c->camera.up.mag()/H;
+      c->pixelSpread = ((sx>sy) ? sx : sy)/c->camera.forward.mag();
+   }
+   const unsigned long long allocsBefore = allocCount();
+   struct timeval last;
+   gettimeofday(&last, NULL);
+
+   runWorkers(workers, [&](int worker, int numWorkers) -> unsigned long long {
+      // Per-thread scratch tile, copied into data once finished
+      unsigned char scratch[3*TILE_SIZE*TILE_SIZE];
+      int t;
+      while((t = scheduler->next(worker)) >= 0){
+         const int x0 = (t%tilesX)*TILE_SIZE, y0 = (t/tilesX)*TILE_SIZE;
+         const int tw = (x0+TILE_SIZE <= W) ? TILE_SIZE : W-x0;
+         const int th = (y0+TILE_SIZE <= H) ? TILE_SIZE : H-y0;
+         renderTile(c, x0, y0, tw, th, scratch, ids);
+         for(int j = 0; j<th; ++j)
+            memcpy(&data[3*(x0+(y0+j)*W)], &scratch[3*j*tw], 3*tw);
+
+         if (progressFile) {
+            progress->done[t].store(true, std::memory_order_release);
+            if (worker == 0) {
+               struct timeval now;
+               gettimeofday(&now, NULL);
+               if (tdiff(&last, &now) >= progressInterval) {
+                  // fopen's buffers are file output, not rendering
+                  UncountedAllocs uncounted;
+                  progress->write(data, tilesX*tilesY, tilesX);
+                  last = now;
+               }
+            }
+         }
+      }
+      if (counters) flushStats(counters);
+      return 0;
+   });
+   unsigned long long rays = (unsigned long long)W*H;
+   if (ids) rays += refineEdges(c, data, workers, scheduler, ids, edges, counters);
+   renderAllocs += allocCount() - allocsBefore;
+   return rays;
 }
 
-void outputPPM(FILE* f){
+void outputPPM(FILE* f, const unsigned char* data){
    fprintf(f, "P6 %d %d 255 ", W, H);
-   fwrite(DATA, 1, W*H * 3, f);
+   fwrite(data, 1, W*H * 3, f);
 }
 
-void outputPPM(char* file){
+void outputPPM(const char* file, const unsigned char* data){
    FILE* f = fopen(file, "w");
-   outputPPM(f);
+   outputPPM(f, data);
    fclose(f);
 }
-void output(char* file){
+// OPTIM: common formats are encoded in process (PNG and QOI by encoder, the
+// rest with stb_image_write), only anything else still goes through
+// ImageMagick
+void output(const char* file, const unsigned char* data, ImageEncoder* encoder){
+   const char* ext = findExtension(file);
+   int written = -1;
+   if (extensionEquals(ext, "png") || extensionEquals(ext, "qoi")) {
+      size_t size;
+      const unsigned char* image = extensionEquals(ext, "png") ? encoder->png(data, &size) : encoder->qoi(data, &size);
+      FILE* f = image ? fopen(file, "wb") : NULL;
+      written = f && fwrite(image, 1, size, f) == size;
+      if (f && fclose(f) != 0) written = 0;
+   } else if (extensionEquals(ext, "jpg") || extensionEquals(ext, "jpeg")) {
+      written = stbi_write_jpg(file, W, H, 3, data, 95);
+   } else if (extensionEquals(ext, "bmp")) {
+      written = stbi_write_bmp(file, W, H, 3, data);
+   } else if (extensionEquals(ext, "tga")) {
+      written = stbi_write_tga(file, W, H, 3, data);
+   }
+   if (written == 0) {
+      printf("Could not write image %s\n", file);
+      exit(1);
+   }
+   if (written > 0) return;
+
    char command[2000];
    FILE* f;
    snprintf(command, sizeof(command), "magick ppm:- %s", file);
    printf("%s\n",command);
    f = popen(command, "w");
-   outputPPM(f);
+   outputPPM(f, data);
    pclose(f);
 }
 
+// Where finished frames go, used on the FrameWriter thread
+struct FrameSink {
+   const char* outFile;
+   bool single, png;
+   int frames;
+   // Movie stream (ffmpeg stdin or a y4m file), NULL for one file per frame
+   FILE* stream;
+   bool y4m;
+   unsigned char* scratch;
+   ImageEncoder* encoder;
+   // Time spent encoding and writing frames, on the writer thread
+   double encodeTime;
+   // --stats output and the per frame records it is written from
+   FILE* statsOut;
+   FrameStats* stats;
+};
+
+void encodeFrame(const unsigned char* data, int frame, FrameSink* sink){
+   if (sink->stream) {
+      if (sink->y4m) {
+         writeY4MFrame(sink->stream, data, W, H, sink->scratch);
+      } else if (fwrite(data, 1, W*H*3, sink->stream) != (size_t)(W*H*3)) {
+         printf("Could not stream frame %d to ffmpeg\n", frame);
+         exit(1);
+      }
+      return;
+   }
+   char file[1000];
+   if (sink->single) {
+      snprintf(file, sizeof(file), "%s", sink->outFile);
+   } else if (sink->png) {
+      snprintf(file, sizeof(file), "%s.tmp.%07d.png", sink->outFile, frame);
+   } else {
+      snprintf(file, sizeof(file), "%s.tmp.%07d.ppm", sink->outFile, frame);
+   }
+   if (sink->png) {
+      // OPTIM: every frame but the last is encoded while the renderers keep
+      // all the cores busy with the next ones, where an encoder team would
+      // only oversubscribe them, so it runs on the writer thread alone. The
+      // last has nothing left to overlap and takes every core.
+      sink->encoder->setThreads(frame + 1 < sink->frames ? 1 : omp_get_max_threads());
+      output(file, data, sink->encoder);
+   } else {
+      outputPPM(file, data);
+   }
+}
+
+void writeFrame(const unsigned char* data, int frame, void* arg){
+   FrameSink* sink = (FrameSink*)arg;
+   // Overlaps the next frame's render but is not part of it
+   UncountedAllocs uncounted;
+   struct timeval before, after;
+   gettimeofday(&before, NULL);
+   encodeFrame(data, frame, sink);
+   gettimeofday(&after, NULL);
+   sink->encodeTime += tdiff(&before, &after);
+   // Frames arrive in order, so the stats lines come out in order too
+   if (sink->statsOut) {
+      sink->stats[frame].output = tdiff(&before, &after);
+      writeFrameStats(sink->statsOut, frame, sink->stats[frame]);
+   }
+}
+
 __attribute__((always_inline))
 constexpr  inline int streq(const char* a, const char* b) {
    return strcmp(a, b) == 0;
 }
 
-// Similar to fscanf, except ignore empty and comment lines
-// Kept as a macro to preserve compiler warnings for mismatch input type
-#define lscanf(f, ...) \
-({\
-   char line[1000];\
-   char* linePtr = line;\
-   size_t len = sizeof(line);\
-   int retval;\
-   while ((retval = getline(&linePtr, &len, f)) != EOF) {\
-      if (line[0] == '#') continue;\
-      if (line[0] == '\n') continue;\
-      if (line[0] == '\0') continue;\
-      sscanf(line, __VA_ARGS__);\
-      break;\
-   }\
-   retval;\
-})
-
-Texture* parseTexture(FILE* f, bool allowNull) {
+Texture* parseTexture(SceneReader& in, bool allowNull) {
    char texture_type[80];
 
-   if (lscanf(f, "%s", texture_type) == EOF) {
-      printf("Found EOF while parsing texture type\n");
-      exit(1);
+   if (in.scan("%79s", texture_type) != 1) {
+      in.fail("Found EOF while parsing texture type");
    }
    if (streq(texture_type, "null")) {
       if (allowNull)
@@ -124,50 +463,46 @@ Texture* parseTexture(FILE* f, bool allowNull) {
    }
    if (streq(texture_type, "color")) {
       int r, g, b;
-      double opacity, reflection, ambient;
-      if (lscanf(f, "%d %d %d %lf %lf %lf\n", &r, &g, &b, &opacity, &reflection, &ambient) == EOF) {
-         printf("Could not read <r> <g> <b> <opacity> <reflection> <ambient>\n");
-         exit(1);
+      // Scenes give backgrounds as a bare <r> <g> <b>, the rest was never
+      // read for them
+      double opacity = 1, reflection = 0, ambient = 0;
+      if (in.scan("%d %d %d %lf %lf %lf", &r, &g, &b, &opacity, &reflection, &ambient) < 3) {
+         in.fail("Could not read <r> <g> <b> [<opacity> <reflection> <ambient>]");
       }
       return new ColorTexture((unsigned char)r, (unsigned char)g, (unsigned char)b, opacity, reflection, ambient);
    }
    if (streq(texture_type, "image")) {
       char image_file[100];
-      if (lscanf(f, "%s\n", image_file) == EOF) {
-         printf("Could not read <image path>\n");
-         exit(1);
+      if (in.scan("%99s", image_file) != 1) {
+         in.fail("Could not read <image path>");
       }
       return new ImageTexture(image_file);
    }
    if (streq(texture_type, "maskedimage")) {
       char image_file[100];
-      if (lscanf(f, "%s\n", image_file) == EOF) {
-         printf("Could not read <image path>\n");
-         exit(1);
+      if (in.scan("%99s", image_file) != 1) {
+         in.fail("Could not read <image path>");
       }
-      ImageTexture *text = new ImageTexture(image_file);
-      text->maskImageAlpha();
-      return text;
+      return new ImageTexture(image_file, true);
    }
    if (streq(texture_type, "inlineimage")) {
       int w, h;
       double opacity, reflection, ambient;
-      if (lscanf(f, "%d %d %lf %lf %lf\n", &w, &h, &opacity, &reflection, &ambient) == EOF) {
-         printf("Could not read <w> <h> <b> <opacity> <reflection> <ambient>\n");
-         exit(1);
+      if (in.scan("%d %d %lf %lf %lf", &w, &h, &opacity, &reflection, &ambient) != 5) {
+         in.fail("Could not read <w> <h> <b> <opacity> <reflection> <ambient>");
       }
 
       ImageTexture* text = new ImageTexture(w, h);
       for (int x=0; x<w; x++) {
          for (int y=0; y<h; y++) {
             int r, g, b;
-            if (lscanf(f, "%d %d %d\n", &r, &g, &b) == EOF) {
-               printf("Could not read <r> <g> <b>\n");
-               exit(1);
+            if (in.scan("%d %d %d", &r, &g, &b) != 3) {
+               in.fail("Could not read <r> <g> <b>");
             }
            text->setColor(x, y, r, g, b);
          }
       }
+      text->prepare();
       text->opacity = opacity;
       text->reflection = reflection;
       text->ambient = ambient;
@@ -179,27 +514,23 @@ Texture* parseTexture(FILE* f, bool allowNull) {
 }
 
 
-Vector* getVectors(FILE* f, int len){
-   Vector* vec = (Vector*)malloc(len*sizeof(Vector));
-   float x, y, z;
-   for(int i = 0; i<len; i++){
-      if (fscanf(f, "%f %f %f\n", &x, &y, &z) == EOF) {
-         printf("Failed to read vectors\n");
-         exit(1);
+// Packed x y z floats, the layout Mesh keeps its points in
+float* getVectors(const char* file, int len){
+   SceneReader in(file);
+   float* vec = (float*)malloc(3*len*sizeof(float));
+   for(int i = 0; i<3*len; i+=3){
+      if (in.scanWords("%f %f %f", &vec[i], &vec[i+1], &vec[i+2]) != 3) {
+         in.fail("Failed to read vectors");
       }
-      vec[i].x = x;
-      vec[i].y = y;
-      vec[i].z = z;
    }
    return vec;
 }
-unsigned int* getTriangles(FILE* f, int len){
+unsigned int* getTriangles(const char* file, int len){
+   SceneReader in(file);
    unsigned int* vec = (unsigned int*)malloc(3*len*sizeof(unsigned int));
-   int a, b, d;
    for(int i = 0; i<3*len; i+=3){
-      if (fscanf(f, "%d %d %d\n", &vec[i], &vec[i+1], &vec[i+2]) == EOF) {
-         printf("Failed to read triangles\n");
-         exit(1);
+      if (in.scanWords("%u %u %u", &vec[i], &vec[i+1], &vec[i+2]) != 3) {
+         in.fail("Failed to read triangles");
       }
    }
    return vec;
@@ -215,18 +546,12 @@ Autonoma* createInputs(const char* inputFile) {
    double roll = 0;
    Texture *background = NULL;
 
-   FILE *f = NULL;
-   if (inputFile) {
-      f = fopen(inputFile, "r");
-      if (!f) {
-         printf("Could not open input file %s\n", inputFile);
-         exit(1);
+   SceneReader* in = inputFile ? new SceneReader(inputFile) : NULL;
+   if (in) {
+      if (in->scan("%lf %lf %lf %lf %lf %lf", &camera_x, &camera_y, &camera_z, &yaw, &pitch, &roll) != 6) {
+         in->fail("Could not read <camera_x> <camera_y> <camera_z> <yaw> <pitch> <roll>");
       }
-      if (lscanf(f, "%lf %lf %lf %lf %lf %lf\n", &camera_x, &camera_y, &camera_z, &yaw, &pitch, &roll) == EOF) {
-         printf("Could not read <camera_x> <camera_y> <camera_z> <yaw> <pitch> <roll>\n");
-         exit(1);
-      }
-      background = parseTexture(f, false);
+      background = parseTexture(*in, false);
    }
    if (!background) {
       const char* texture_path = "images/skybox.jpg";
@@ -234,15 +559,16 @@ Autonoma* createInputs(const char* inputFile) {
    }
    Autonoma* MAIN_DATA = new Autonoma(Camera(Vector(camera_x, camera_y, camera_z), yaw, pitch, roll),background);
 
-   if (f) {
+   if (in) {
       char object_type[80];
-      while (lscanf(f, "%s", object_type) != EOF) {
+      // Meshes in file order, for instances to refer to
+      std::vector<Mesh*> meshes;
+      while (in->scan("%79s", object_type) == 1) {
          if (streq(object_type, "light")) {
             double light_x, light_y, light_z;
             int color_r, color_g, color_b;
-            if (lscanf(f, "%lf %lf %lf %d %d %d\n", &light_x, &light_y, &light_z, &color_r, &color_g, &color_b) == EOF) {
-               printf("Could not read <light_x> <light_y> <light_z> <color_r> <color_g> <color_b>\n");
-               exit(1);
+            if (in->scan("%lf %lf %lf %d %d %d", &light_x, &light_y, &light_z, &color_r, &color_g, &color_b) != 6) {
+               in->fail("Could not read <light_x> <light_y> <light_z> <color_r> <color_g> <color_b>");
             }
             Light *light = new Light(Vector(light_x, light_y, light_z), getColor(color_r, color_g, color_b));
             MAIN_DATA->addLight(light);
@@ -250,62 +576,57 @@ Autonoma* createInputs(const char* inputFile) {
             double plane_x, plane_y, plane_z;
             double yaw, pitch, roll;
             double tx, ty;
-            if (lscanf(f, "%lf %lf %lf %lf %lf %lf %lf %lf\n", &plane_x, &plane_y, &plane_z, &yaw, &pitch, &roll, &tx, &ty) == EOF) {
-               printf("Could not read <plane_x> <plane_y> <plane_z> <yaw> <pitch> <roll> <tx> <ty>\n");
-               exit(1);
+            if (in->scan("%lf %lf %lf %lf %lf %lf %lf %lf", &plane_x, &plane_y, &plane_z, &yaw, &pitch, &roll, &tx, &ty) != 8) {
+               in->fail("Could not read <plane_x> <plane_y> <plane_z> <yaw> <pitch> <roll> <tx> <ty>");
             }
-            Texture *texture = parseTexture(f, false);
+            Texture *texture = parseTexture(*in, false);
             Plane *shape = new Plane(Vector(plane_x, plane_y, plane_z), texture, yaw, pitch, roll, tx, ty);
             MAIN_DATA->addShape(shape);
-            shape->normalMap = parseTexture(f, true);
+            shape->normalMap = parseTexture(*in, true);
          } else if (streq(object_type, "disk")) {
             double disk_x, disk_y, disk_z;
             double yaw, pitch, roll;
             double tx, ty;
-            if (lscanf(f, "%lf %lf %lf %lf %lf %lf %lf %lf\n", &disk_x, &disk_y, &disk_z, &yaw, &pitch, &roll, &tx, &ty) == EOF) {
-               printf("Could not read <disk_x> <disk_y> <disk_z> <yaw> <pitch> <roll> <tx> <ty>\n");
-               exit(1);
+            if (in->scan("%lf %lf %lf %lf %lf %lf %lf %lf", &disk_x, &disk_y, &disk_z, &yaw, &pitch, &roll, &tx, &ty) != 8) {
+               in->fail("Could not read <disk_x> <disk_y> <disk_z> <yaw> <pitch> <roll> <tx> <ty>");
             }
-            Texture *texture = parseTexture(f, false);
+            Texture *texture = parseTexture(*in, false);
             Disk* shape = new Disk(Vector(disk_x, disk_y, disk_z), texture, yaw, pitch, roll, tx, ty);
             MAIN_DATA->addShape(shape);
-            shape->normalMap = parseTexture(f, true);
+            shape->normalMap = parseTexture(*in, true);
          } else if (streq(object_type, "box")) {
             double box_x, box_y, box_z;
             double yaw, pitch, roll;
             double tx, ty;
-            if (lscanf(f, "%lf %lf %lf %lf %lf %lf %lf %lf\n", &box_x, &box_y, &box_z, &yaw, &pitch, &roll, &tx, &ty) == EOF) {
-               printf("Could not read <box_x> <box_y> <box_z> <yaw> <pitch> <roll> <tx> <ty>\n");
-               exit(1);
+            if (in->scan("%lf %lf %lf %lf %lf %lf %lf %lf", &box_x, &box_y, &box_z, &yaw, &pitch, &roll, &tx, &ty) != 8) {
+               in->fail("Could not read <box_x> <box_y> <box_z> <yaw> <pitch> <roll> <tx> <ty>");
             }
-            Texture *texture = parseTexture(f, false);
+            Texture *texture = parseTexture(*in, false);
             Box* shape = new Box(Vector(box_x, box_y, box_z), texture, yaw, pitch, roll, tx, ty);
             MAIN_DATA->addShape(shape);
-            shape->normalMap = parseTexture(f, true);
+            shape->normalMap = parseTexture(*in, true);
          } else if (streq(object_type, "triangle")) {
             double x1, y1, z1;
             double x2, y2, z2;
             double x3, y3, z3;
-            if (lscanf(f, "%lf %lf %lf %lf %lf %lf %lf %lf %lf\n", &x1, &y1, &z1, &x2, &y2, &z2, &x3, &y3, &z3) == EOF) {
-               printf("Could not read <x1> <y1> <z1> <x2> <y2> <z2> <x3> <y3> <z3>\n");
-               exit(1);
+            if (in->scan("%lf %lf %lf %lf %lf %lf %lf %lf %lf", &x1, &y1, &z1, &x2, &y2, &z2, &x3, &y3, &z3) != 9) {
+               in->fail("Could not read <x1> <y1> <z1> <x2> <y2> <z2> <x3> <y3> <z3>");
             }
-            Texture *texture = parseTexture(f, false);
+            Texture *texture = parseTexture(*in, false);
             Triangle* shape = new Triangle(Vector(x1, y1, z1), Vector(x2, y2, z2), Vector(x3, y3, z3), texture);
             MAIN_DATA->addShape(shape);
-            shape->normalMap = parseTexture(f, true);
+            shape->normalMap = parseTexture(*in, true);
          } else if (streq(object_type, "sphere")) {
             double sphere_x, sphere_y, sphere_z;
             double yaw, pitch, roll;
             double radius;
-            if (lscanf(f, "%lf %lf %lf %lf %lf %lf %lf\n", &sphere_x, &sphere_y, &sphere_z, &yaw, &pitch, &roll, &radius) == EOF) {
-               printf("Could not read <sphere_x> <sphere_y> <sphere_z> <yaw> <pitch> <roll> <radius>\n");
-               exit(1);
+            if (in->scan("%lf %lf %lf %lf %lf %lf %lf", &sphere_x, &sphere_y, &sphere_z, &yaw, &pitch, &roll, &radius) != 7) {
+               in->fail("Could not read <sphere_x> <sphere_y> <sphere_z> <yaw> <pitch> <roll> <radius>");
             }
-            Texture *texture = parseTexture(f, false);
+            Texture *texture = parseTexture(*in, false);
             Sphere* shape = new Sphere(Vector(sphere_x, sphere_y, sphere_z), texture, yaw, pitch, roll, radius);
             MAIN_DATA->addShape(shape);
-            shape->normalMap = parseTexture(f, true);
+            shape->normalMap = parseTexture(*in, true);
          } else if (streq(object_type, "mesh")) {
              char point_filepath[100];
              char poly_filepath[100];
@@ -314,39 +635,67 @@ Autonoma* createInputs(const char* inputFile) {
              double off_x;
              double off_y;
              double off_z;
-            if (lscanf(f, "%s %d %s %d %lf %lf %lf\n", point_filepath, &num_points, poly_filepath, &num_polygons, &off_x, &off_y, &off_z) == EOF) {
-               printf("Could not read <point filepath> <num_points> <polygons filepath> <num_polygons> <off_x> <off_y> <off_z>\n");
-               exit(1);
+            if (in->scan("%99s %d %99s %d %lf %lf %lf", point_filepath, &num_points, poly_filepath, &num_polygons, &off_x, &off_y, &off_z) != 7) {
+               in->fail("Could not read <point filepath> <num_points> <polygons filepath> <num_polygons> <off_x> <off_y> <off_z>");
             }
-            Texture *texture = parseTexture(f, false);
-            Texture *normalMap = parseTexture(f, true);
+            Texture *texture = parseTexture(*in, false);
+            Texture *normalMap = parseTexture(*in, true);
 
-            FILE* vectors = fopen(point_filepath,"r"), *triangles = fopen(poly_filepath,"r");
-            if (!vectors) {
-               printf("Could not open point file %s\n", point_filepath);
-               exit(1);
+            // OPTIM: mmap a binary cache of the text files when there is a fresh one
+            float* points;
+            unsigned int* polys;
+            char cache_filepath[120];
+            snprintf(cache_filepath, sizeof(cache_filepath), "%s.meshcache", poly_filepath);
+            MeshCacheHeader cache_header;
+            if (!readMeshCache(cache_filepath, point_filepath, poly_filepath, num_points, num_polygons, &points, &polys, &cache_header)) {
+               points = getVectors(point_filepath, num_points);
+               polys = getTriangles(poly_filepath, num_polygons);
+               writeMeshCache(cache_filepath, cache_header, points, polys);
             }
-            if (!triangles) {
-               printf("Could not open triangles file %s\n", poly_filepath);
-               exit(1);
+            // OPTIM: one Mesh shape with flat face arrays instead of a Triangle per face
+            Mesh* shape = new Mesh(points, num_points, polys, num_polygons, Vector(off_x, off_y, off_z), texture);
+            MAIN_DATA->addShape(shape);
+            shape->normalMap = normalMap;
+            meshes.push_back(shape);
+         } else if (streq(object_type, "instance")) {
+            int mesh;
+            double off_x, off_y, off_z, yaw, pitch, roll;
+            if (in->scan("%d %lf %lf %lf %lf %lf %lf", &mesh, &off_x, &off_y, &off_z, &yaw, &pitch, &roll) != 7) {
+               in->fail("Could not read <mesh> <off_x> <off_y> <off_z> <yaw> <pitch> <roll>");
             }
-            Vector* points = getVectors(vectors, num_points);
-            fclose(vectors);
-            unsigned int* polys = getTriangles(triangles, num_polygons);
-            fclose(triangles);
-            Vector offset(off_x, off_y, off_z); 
-            for(int i = 0; i<num_polygons; i++){
-               Triangle* shape = new Triangle(points[polys[3*i]] + offset, points[polys[3*i+1]] + offset, points[polys[3*i+2]] + offset, texture);
-               MAIN_DATA->addShape(shape);
-               shape->normalMap = normalMap;
+            if (mesh < 0 || mesh >= (int)meshes.size()) {
+               printf("Mesh %d does not exist, %d meshes are loaded before this instance\n", mesh, (int)meshes.size());
+               exit(1);
             }
+            // null keeps the mesh's texture or normal map
+            Texture *texture = parseTexture(*in, true);
+            Texture *normalMap = parseTexture(*in, true);
+            // OPTIM: shares the mesh's faces and BVH, only the transform is new
+            Instance* shape = new Instance(*meshes[mesh], Vector(off_x, off_y, off_z), texture ? texture : meshes[mesh]->texture, yaw, pitch, roll);
+            if (normalMap) shape->normalMap = normalMap;
+            MAIN_DATA->addShape(shape);
          } else {
            printf("Unknown object type %s\n", object_type);
            exit(1);
          }
       }
+      if (!in->eof()) {
+         in->fail("Could not read <object type>");
+      }
+      delete in;
    }
 
+   MAIN_DATA->buildBVH();
+   // A cube face spans 90 degrees, so 2 / (radians per skybox texel) texels
+   // per side keep its center as sharp as the image. Flat colors need one.
+   unsigned int cubeSize = 1;
+   if (ImageTexture* image = dynamic_cast<ImageTexture*>(MAIN_DATA->skybox)) {
+      const double perRadian = (image->w/M_TWO_PI > image->h) ? image->w/M_TWO_PI : image->h;
+      cubeSize = (unsigned int)(2*perRadian);
+      if (cubeSize > SKY_CUBE_MAX) cubeSize = SKY_CUBE_MAX;
+      if (cubeSize < 1) cubeSize = 1;
+   }
+   MAIN_DATA->skyCube = new SkyCube(MAIN_DATA->skybox, cubeSize);
    return MAIN_DATA;
 }
 
@@ -370,80 +719,160 @@ constexpr inline double cosfn(double x, double from, double to) {
    return (to - from) * cos(x * 6.28) + from;
 }
 
-void setFrame(const char* animateFile, Autonoma* MAIN_DATA, int frame, int frameLen) {
-   if (animateFile) {
-      char object_type[80];
-      char transition_type[80];
-      int obj_num;
-      char field_type[80];
-      double from;
-      double to;
-      FILE* f = fopen(animateFile, "r");
-      while (lscanf(f, "%s %s %d %s %lf %lf", transition_type, object_type, &obj_num, field_type, &from, &to) != EOF) {
-         double (*func)(double, double, double);
-         if (streq(transition_type, "linear")) {
-            func = identity;
-         } else if (streq(transition_type, "exp")) {
-            func = expfn;
-         } else if (streq(transition_type, "sin")) {
-            func = sinfn;
-         } else if (streq(transition_type, "cos")) {
-            func = cosfn;
+Animation* compileAnimation(const char* animateFile, Autonoma* MAIN_DATA) {
+   char object_type[80];
+   char transition_type[80];
+   int obj_num;
+   char field_type[80];
+   double from;
+   double to;
+   SceneReader in(animateFile);
+   Animation* animation = new Animation();
+   while (in.scan("%79s %79s %d %79s %lf %lf", transition_type, object_type, &obj_num, field_type, &from, &to) == 6) {
+      AnimTrack track;
+      track.from = from;
+      track.to = to;
+      if (streq(transition_type, "linear")) {
+         track.func = identity;
+      } else if (streq(transition_type, "exp")) {
+         track.func = expfn;
+      } else if (streq(transition_type, "sin")) {
+         track.func = sinfn;
+      } else if (streq(transition_type, "cos")) {
+         track.func = cosfn;
+      } else {
+         printf("Unknown transition type %s, expected one of linear, exp, cos, or sin\n", transition_type);
+         exit(1);
+      }
+
+      if (streq(object_type, "camera")) {
+         track.shapeIndex = -1;
+         if (streq(field_type, "yaw")) {
+            track.field = ANIM_YAW;
+         } else if (streq(field_type, "pitch")) {
+            track.field = ANIM_PITCH;
+         } else if (streq(field_type, "roll")) {
+            track.field = ANIM_ROLL;
+         } else if (streq(field_type, "x")) {
+            track.field = ANIM_X;
+         } else if (streq(field_type, "y")) {
+            track.field = ANIM_Y;
+         } else if (streq(field_type, "z")) {
+            track.field = ANIM_Z;
          } else {
-            printf("Unknown transition type %s, expected one of linear, exp, cos, or sin\n", transition_type);
+            printf("Unknown camera field_type %s, expected one of yaw, pitch, roll, x, y, z\n", field_type);
             exit(1);
          }
-         double result = func((double)frame / frameLen, from, to);
-
-         if (streq(object_type, "camera")) {
-            if (streq(field_type, "yaw")) {
-               MAIN_DATA->camera.setYaw(result);
-            } else if (streq(field_type, "pitch")) {
-               MAIN_DATA->camera.setPitch(result);
-            } else if (streq(field_type, "roll")) {
-               MAIN_DATA->camera.setRoll(result);
-            } else if (streq(field_type, "x")) {
-               MAIN_DATA->camera.focus.x = result;
-            } else if (streq(field_type, "y")) {
-               MAIN_DATA->camera.focus.y = result;
-            } else if (streq(field_type, "z")) {
-               MAIN_DATA->camera.focus.z = result;
-            } else {
-               printf("Unknown camera field_type %s, expected one of yaw, pitch, roll, x, y, z\n", field_type);
-               exit(1);
-            }
-         } else if (streq(object_type, "object")) {
-            Shape* shape = MAIN_DATA->shapes[obj_num];
-            if (streq(field_type, "yaw")) {
-               shape->setYaw(result);
-            } else if (streq(field_type, "pitch")) {
-               shape->setPitch(result);
-            } else if (streq(field_type, "roll")) {
-               shape->setRoll(result);
-            } else if (streq(field_type, "textureX")) {
-               shape->textureX = result;
-            } else if (streq(field_type, "textureY")) {
-               shape->textureY = result;
-            } else if (streq(field_type, "mapX")) {
-               shape->mapX = result;
-            } else if (streq(field_type, "mapY")) {
-               shape->mapY = result;
-            } else if (streq(field_type, "mapOffX")) {
-               shape->mapOffX = result;
-            } else if (streq(field_type, "mapOffY")) {
-               shape->mapOffY = result;
-            } else {
-               printf("Unknown shape field_type %s, expected one of yaw, pitch, roll, textureX, textureY, mapX, mapY, mapOffX, mapOffY\n", field_type);
-               exit(1);
-            }
+      } else if (streq(object_type, "object")) {
+         if (obj_num < 0 || obj_num >= (int)MAIN_DATA->shapes.size()) {
+            printf("Object %d does not exist, the scene has %d objects\n", obj_num, (int)MAIN_DATA->shapes.size());
+            exit(1);
+         }
+         track.shapeIndex = obj_num;
+         if (streq(field_type, "yaw")) {
+            track.field = ANIM_YAW;
+         } else if (streq(field_type, "pitch")) {
+            track.field = ANIM_PITCH;
+         } else if (streq(field_type, "roll")) {
+            track.field = ANIM_ROLL;
+         } else if (streq(field_type, "textureX")) {
+            track.field = ANIM_TEXTURE_X;
+         } else if (streq(field_type, "textureY")) {
+            track.field = ANIM_TEXTURE_Y;
+         } else if (streq(field_type, "mapX")) {
+            track.field = ANIM_MAP_X;
+         } else if (streq(field_type, "mapY")) {
+            track.field = ANIM_MAP_Y;
+         } else if (streq(field_type, "mapOffX")) {
+            track.field = ANIM_MAP_OFF_X;
+         } else if (streq(field_type, "mapOffY")) {
+            track.field = ANIM_MAP_OFF_Y;
          } else {
-            printf("Unknown object_type %s, expected one of camera, object\n", field_type);
+            printf("Unknown shape field_type %s, expected one of yaw, pitch, roll, textureX, textureY, mapX, mapY, mapOffX, mapOffY\n", field_type);
             exit(1);
          }
+      } else {
+         printf("Unknown object_type %s, expected one of camera, object\n", field_type);
+         exit(1);
       }
+      animation->tracks.push_back(track);
+   }
+   if (!in.eof()) {
+      in.fail("Could not read <transition> <object_type> <object> <field> <from> <to>");
+   }
+   return animation;
+}
+
+// Returns the camera rays the frame took. Timings and counters go to stats
+// unless it is NULL.
+unsigned long long setFrame(Animation* animation, Autonoma* MAIN_DATA, unsigned char* data, int frame, int frameLen, int workers, Shape** ids, unsigned char* edges, FrameStats* stats) {
+   struct timeval start, rendering, end;
+   gettimeofday(&start, NULL);
+   if (animation) {
+      animation->apply(MAIN_DATA, frame, frameLen);
    }
 
-   refresh(MAIN_DATA);
+   gettimeofday(&rendering, NULL);
+   const unsigned long long rays = refresh(MAIN_DATA, data, workers, ids, edges, stats ? &stats->counters : NULL);
+   gettimeofday(&end, NULL);
+   if (stats) {
+      stats->setFrame = tdiff(&start, &end);
+      stats->refresh = tdiff(&rendering, &end);
+      stats->cameraRays = rays;
+   }
+   return rays;
+}
+
+// What --serve keeps between requests
+struct ServeState {
+   Autonoma* scene;
+   // The camera as loaded, which camera requests overwrite in scene
+   Camera camera;
+   Animation* animation;
+   int frameLen;
+   bool png;
+   ImageEncoder* encoder;
+   unsigned char* data;
+   Shape** aaIds;
+   unsigned char* aaEdges;
+   int requests;
+};
+
+void serveRequest(const RenderRequest& request, FILE* out, void* arg){
+   ServeState* s = (ServeState*)arg;
+   struct timeval start, rendered, end;
+   gettimeofday(&start, NULL);
+   if (request.kind == REQUEST_FRAME) {
+      if (request.frame < 0 || request.frame >= s->frameLen) {
+         char message[100];
+         snprintf(message, sizeof(message), "Frame %d does not exist, the animation has %d frames", request.frame, s->frameLen);
+         serveError(out, message);
+         return;
+      }
+      // Channels the animation does not key keep their loaded values
+      s->scene->camera = s->camera;
+      setFrame(s->animation, s->scene, s->data, request.frame, s->frameLen, omp_get_max_threads(), s->aaIds, s->aaEdges, NULL);
+   } else {
+      s->scene->camera.focus = Vector(request.x, request.y, request.z);
+      s->scene->camera.setAngles(request.yaw, request.pitch, request.roll);
+      refresh(s->scene, s->data, omp_get_max_threads(), s->aaIds, s->aaEdges, NULL);
+   }
+   gettimeofday(&rendered, NULL);
+   if (s->png) {
+      size_t size;
+      const unsigned char* png = s->encoder->png(s->data, &size);
+      if (!png) {
+         serveError(out, "Could not encode image");
+         return;
+      }
+      serveImage(out, NULL, png, size);
+   } else {
+      char head[64];
+      snprintf(head, sizeof(head), "P6 %d %d 255 ", W, H);
+      serveImage(out, head, s->data, (size_t)W*H*3);
+   }
+   gettimeofday(&end, NULL);
+   printf("Done Request %5d| render=%0.6f seconds, encode and send=%0.6f seconds\n", s->requests++, tdiff(&start, &rendered), tdiff(&rendered, &end));
 }
 
 int main(int argc, const char** argv){
@@ -519,8 +948,82 @@ int main(int argc, const char** argv){
          png = true;
          continue;
       }
+      if (streq(argv[i], "--packet")) {
+         packetMode = true;
+         continue;
+      }
+      if (streq(argv[i], "--scalar")) {
+         packetMode = false;
+         continue;
+      }
+      if (streq(argv[i], "--progressive")) {
+         if (i + 1 >= argc) {
+            printf("Error --progressive option must be followed by an interval in seconds");
+         }
+         progressInterval = atof(argv[i+1]);
+         progressFile = "";
+         i++;
+         continue;
+      }
+      if (streq(argv[i], "--frame-parallel")) {
+         if (i + 1 >= argc) {
+            printf("Error --frame-parallel option must be followed by a number of frames");
+         }
+         frameParallel = atoi(argv[i+1]);
+         if (frameParallel < 1) frameParallel = 1;
+         i++;
+         continue;
+      }
+      if (streq(argv[i], "--reuse-hits")) {
+         reuseHits = true;
+         continue;
+      }
+      if (streq(argv[i], "--aa")) {
+         if (i + 1 >= argc) {
+            printf("Error --aa option must be followed by a rays per pixel budget");
+         }
+         aaBudget = atof(argv[i+1]);
+         if (!(aaBudget >= 1)) {
+            printf("Error --aa budget must be at least 1 ray per pixel\n");
+            return 1;
+         }
+         i++;
+         continue;
+      }
+      if (streq(argv[i], "--stats")) {
+         if (i + 1 >= argc) {
+            printf("Error --stats option must be followed by an output file path");
+         }
+         statsFile = argv[i+1];
+         i++;
+         continue;
+      }
+      if (streq(argv[i], "--serve")) {
+         if (i + 1 >= argc) {
+            printf("Error --serve option must be followed by a socket path, or - for stdin");
+         }
+         serveFile = argv[i+1];
+         i++;
+         continue;
+      }
+      if (streq(argv[i], "--filter-textures")) {
+         filterTextures = true;
+         continue;
+      }
+      if (streq(argv[i], "--cache-shadows")) {
+         if (i + 1 >= argc) {
+            printf("Error --cache-shadows option must be followed by a cell size");
+         }
+         shadowCell = atof(argv[i+1]);
+         if (!(shadowCell > 0)) {
+            printf("Error --cache-shadows cell size must be positive\n");
+            return 1;
+         }
+         i++;
+         continue;
+      }
       if (streq(argv[i], "--help")) {
-         printf("Usage %s [-H <height>] [-W <width>] [-F <framecount>] [--movie] [--no-movie] [--png] [--ppm] [--help] [-o <outfile>] [-i <infile>]\n", argv[0]);
+         printf("Usage %s [-H <height>] [-W <width>] [-F <framecount>] [--movie] [--no-movie] [--png] [--ppm] [--packet] [--scalar] [--progressive <seconds>] [--frame-parallel <frames>] [--reuse-hits] [--cache-shadows <cell>] [--filter-textures] [--aa <rays per pixel>] [--stats <jsonfile>] [--serve <socket>] [--help] [-o <outfile>] [-i <infile>]\n", argv[0]);
          return 0;
       }
       printf("Unknown option %s, look at %s --help\n", argv[i], argv[0]);
@@ -539,41 +1042,142 @@ int main(int argc, const char** argv){
       }
    }
 
+   // Partial frames go next to the output as a PPM, which needs no encoder
+   char progressPath[1000];
+   if (progressFile) {
+      snprintf(progressPath, sizeof(progressPath), "%s.partial.ppm", outFile);
+      progressFile = progressPath;
+   }
+
+   if (serveFile) serveOpen(serveFile);
+
+   struct timeval start, end;
+   gettimeofday(&start, NULL);
    Autonoma* MAIN_DATA = createInputs(inFile);
+   Animation* animation = animateFile ? compileAnimation(animateFile, MAIN_DATA) : NULL;
+   gettimeofday(&end, NULL);
+   printf("Total time to load scene=%0.6f seconds\n", tdiff(&start, &end));
+
+   // OPTIM: keep the loaded scene and one framebuffer for any number of
+   // renders instead of paying the start up per image
+   if (serveFile) {
+      ServeState state = {MAIN_DATA, MAIN_DATA->camera, animation, frameLen, png, new ImageEncoder(W, H, omp_get_max_threads()), (unsigned char*)malloc(W*H*3*sizeof(unsigned char)), NULL, NULL, 0};
+      if (reuseHits) MAIN_DATA->hitCache = new HitCache(MAIN_DATA, W*H);
+      if (shadowCell > 0) MAIN_DATA->shadowCache = new ShadowCache(MAIN_DATA, shadowCell);
+      if (aaBudget > 1) {
+         state.aaIds = (Shape**)malloc(W*H*sizeof(Shape*));
+         state.aaEdges = (unsigned char*)malloc(W*H*sizeof(unsigned char));
+      }
+      serve(serveRequest, &state);
+      return 0;
+   }
+   FILE* statsOut = NULL;
+   FrameStats* frameStats = NULL;
+   if (statsFile) {
+      statsOut = fopen(statsFile, "w");
+      if (!statsOut) {
+         printf("Could not open stats output %s\n", statsFile);
+         exit(1);
+      }
+      frameStats = (FrameStats*)calloc(frameLen, sizeof(FrameStats));
+      writeStatsHeader(statsOut, inFile, W, H, frameLen, tdiff(&start, &end));
+   }
    
-   int frame;
-   char command[200];
-   
-  struct timeval start, end;
-   gettimeofday(&start, NULL);
-   for(frame = 0; frame<frameLen; frame++) {
-      setFrame(animateFile, MAIN_DATA, frame, frameLen);      
-      if (frameLen == 1) {
-         snprintf(command, sizeof(command), "%s", outFile);    
-      } else if (png) {
-         snprintf(command, sizeof(command), "%s.tmp.%07d.png", outFile, frame);
+   // OPTIM: frames stream into a single encoder while the next one renders,
+   // instead of going through temporary files and two ffmpeg runs at the end
+   FrameSink sink = {outFile, frameLen == 1, png, frameLen, NULL, false, NULL, NULL, 0, statsOut, frameStats};
+   if (frameLen > 1 && toMovie) {
+      if (extensionEquals(findExtension(outFile), "y4m")) {
+         sink.stream = fopen(outFile, "wb");
+         sink.y4m = true;
+         sink.scratch = (unsigned char*)malloc(W*H*3*sizeof(unsigned char));
+         if (sink.stream) writeY4MHeader(sink.stream, W, H, 24);
       } else {
-         snprintf(command, sizeof(command), "%s.tmp.%07d.ppm", outFile, frame);
+         char command[2000];
+         // A missing or failed ffmpeg surfaces as a short write, not SIGPIPE
+         signal(SIGPIPE, SIG_IGN);
+         snprintf(command, sizeof(command), "ffmpeg -y -loglevel error -f rawvideo -pix_fmt rgb24 -s %dx%d -r 24 -i - -c:v libx264 -preset veryslow -qp 0 -r 24 %s", W, H, outFile);
+         sink.stream = popen(command, "w");
       }
-      if (png) {
-         output(command); 
-      } else {
-         outputPPM(command); 
-      }     
-      printf("Done Frame %7d|\n", frame);
+      if (!sink.stream) {
+         printf("Could not open movie output %s\n", outFile);
+         exit(1);
+      }
+   } else if (png) {
+      sink.encoder = new ImageEncoder(W, H, omp_get_max_threads());
+   }
+
+   gettimeofday(&start, NULL);
+   {
+      // OPTIM: with --frame-parallel, frameThreads copies of the scene each
+      // take the next unrendered frame when they finish one, and the cores
+      // are split between the frames in flight
+      const int frameThreads = (frameParallel < frameLen) ? frameParallel : frameLen;
+      const int pixelThreads = (omp_get_max_threads() / frameThreads > 0) ? omp_get_max_threads() / frameThreads : 1;
+      Autonoma** scenes = (Autonoma**)malloc(frameThreads * sizeof(Autonoma*));
+      scenes[0] = MAIN_DATA;
+      for(int i = 1; i<frameThreads; i++) scenes[i] = MAIN_DATA->clone();
+      if (reuseHits)
+         for(int i = 0; i<frameThreads; i++) scenes[i]->hitCache = new HitCache(scenes[i], W*H);
+      if (shadowCell > 0)
+         for(int i = 0; i<frameThreads; i++) scenes[i]->shadowCache = new ShadowCache(scenes[i], shadowCell);
+      // --aa scratch, one pair per frame thread
+      Shape** aaIds = NULL;
+      unsigned char* aaEdges = NULL;
+      if (aaBudget > 1) {
+         aaIds = (Shape**)malloc(frameThreads * W*H*sizeof(Shape*));
+         aaEdges = (unsigned char*)malloc(frameThreads * W*H*sizeof(unsigned char));
+      }
+
+      FrameWriter writer(frameThreads + 1, W*H*3*sizeof(unsigned char), writeFrame, &sink);
+      // OPTIM: frame threads are plain threads (slot 0 is this one) rather
+      // than an OpenMP team. Each then starts its pixel team at the top level,
+      // which libgomp keeps from one frame to the next, where a nested team
+      // would be allocated afresh for every parallel region.
+      // Frames are claimed only once a buffer is held, so the lowest frame not
+      // yet written always has one and the writer can never stall on it
+      std::atomic<int> nextFrame(0);
+      auto renderFrames = [&](int slot) {
+         while (true) {
+            unsigned char* data = writer.acquire();
+            const int frame = nextFrame.fetch_add(1);
+            if (frame >= frameLen) {
+               writer.release(data);
+               break;
+            }
+            const unsigned long long rays = setFrame(animation, scenes[slot], data, frame, frameLen, pixelThreads,
+                                                     aaIds ? aaIds + slot*W*H : NULL, aaEdges ? aaEdges + slot*W*H : NULL,
+                                                     frameStats ? &frameStats[frame] : NULL);
+            writer.submit(data, frame);
+            if (aaBudget > 1)
+               printf("Done Frame %7d| camera rays=%llu (%.3f per pixel)\n", frame, rays, (double)rays/(W*H));
+            else
+               printf("Done Frame %7d|\n", frame);
+         }
+      };
+      std::vector<std::thread> frameWorkers;
+      {
+         // Overlaps the first frames of the threads already started
+         UncountedAllocs uncounted;
+         for(int i = 1; i<frameThreads; i++) frameWorkers.push_back(std::thread(renderFrames, i));
+      }
+      renderFrames(0);
+      for(size_t i = 0; i<frameWorkers.size(); i++) frameWorkers[i].join();
    }
 
    gettimeofday(&end, NULL);
    printf("Total time to create images=%0.6f seconds\n", tdiff(&start, &end));
+   // Overlaps with rendering except for the last frame
+   printf("Total time to encode images=%0.6f seconds\n", sink.encodeTime);
+   printf("Heap allocations while rendering=%llu\n", renderAllocs.load());
+   if (statsOut) fclose(statsOut);
 
-   if (frameLen > 1 && toMovie) {
-      if (png) {
-         snprintf(command, sizeof(command), "ffmpeg -y -r 24 -i %s.tmp.%%07d.png -vcodec ffv1 %s.tmp.avi && ffmpeg -y -i %s.tmp.avi -c:v libx264 -preset veryslow -qp 0 -r 24 %s", outFile, outFile, outFile, outFile);
-      } else {
-         snprintf(command, sizeof(command), "ffmpeg -y -r 24 -i %s.tmp.%%07d.ppm -vcodec ffv1 %s.tmp.avi && ffmpeg -y -i %s.tmp.avi -c:v libx264 -preset veryslow -qp 0 -r 24 %s", outFile, outFile, outFile, outFile);         
+   if (sink.stream) {
+      if (sink.y4m) {
+         return fclose(sink.stream) != 0;
       }
-      return system(command);
-   }   
+      return pclose(sink.stream);
+   }
    return 0;
    
 }
@@ -1,4 +1,5 @@
 #include "colortexture.h"
+#include "../stats.h"
 ColorTexture::ColorTexture(unsigned char ra, unsigned char ga, unsigned char ba):Texture(.3, 1., 0.){
    r = ra; g = ga; b = ba;
 }
@@ -16,6 +17,7 @@ ColorTexture::ColorTexture(char* def):Texture(.3,1.,0.){
 
 }
 void ColorTexture::getColor(unsigned char* toFill, double* amb, double *op, double *ref, double x, double y){
+   STAT_INC(textureSamples);
    toFill[0] = r; toFill[1] = g; toFill[2] = b;
    *op = opacity;
    *ref = reflection;
@@ -1,16 +1,105 @@
 #include "imagetexture.h"
+#include "../stats.h"
+#include <string>
+#include <vector>
+#define STB_IMAGE_IMPLEMENTATION
+#include "../../external/stb_image.h"
 constexpr double over255 = 1/255.; // in normal folder it's in constants.h but not here
+__attribute__((always_inline))
+static inline const unsigned char* texel(const MipLevel& l, unsigned int x, unsigned int y){
+   return &l.data[4*(((y/TEXTURE_TILE)*l.tilesX+x/TEXTURE_TILE)*TEXTURE_TILE*TEXTURE_TILE+(y%TEXTURE_TILE)*TEXTURE_TILE+x%TEXTURE_TILE)];
+}
+
 void ImageTexture::getColor(unsigned char* toFill, double* am, double *op, double *ref, double x, double y){
+   STAT_INC(textureSamples);
    int xi = (int)(x*w), yi = (int)(y*h);
-   int p1 = 4*(xi+w*yi);
-   toFill[0] = imageData[p1];
-   toFill[1] = imageData[p1+1];
-   toFill[2] = imageData[p1+2];
-   *op = imageData[p1+3]*opacity * over255;
+   const unsigned char* p = mips ? texel(mips[0], xi, yi) : &imageData[4*(xi+w*yi)];
+   toFill[0] = p[0];
+   toFill[1] = p[1];
+   toFill[2] = p[2];
+   *op = p[3]*opacity * over255;
+   *ref = reflection;
+   *am = ambient;
+}
+
+void ImageTexture::getFilteredColor(unsigned char* toFill, double* am, double *op, double *ref, double x, double y, double footprint){
+   if(!(footprint > 0) || !mips){
+      getColor(toFill, am, op, ref, x, y);
+      return;
+   }
+   STAT_INC(textureSamples);
+   // Level whose texels are closest to footprint, ilogb of footprint*w*sqrt(2)
+   // is log2(footprint*w) rounded
+   const unsigned int size = (w > h) ? w : h;
+   int level = ilogb(footprint*size*1.4142135623730951);
+   if(level < 0) level = 0;
+   if(level >= (int)numMips) level = numMips-1;
+   const MipLevel& l = mips[level];
+   const double fx = x*l.w-.5, fy = y*l.h-.5;
+   const double flx = floor(fx), fly = floor(fy);
+   const double tx = fx-flx, ty = fy-fly;
+   // Coordinates wrap like fix() does
+   const int ix = (int)flx, iy = (int)fly;
+   const unsigned int x0 = (ix < 0) ? l.w-1 : ix, x1 = (ix+1 >= (int)l.w) ? 0 : ix+1;
+   const unsigned int y0 = (iy < 0) ? l.h-1 : iy, y1 = (iy+1 >= (int)l.h) ? 0 : iy+1;
+   const unsigned char* a = texel(l, x0, y0);
+   const unsigned char* b = texel(l, x1, y0);
+   const unsigned char* c = texel(l, x0, y1);
+   const unsigned char* d = texel(l, x1, y1);
+   double mix[4];
+   for(int k = 0; k<4; k++){
+      const double top = a[k]+(b[k]-a[k])*tx;
+      const double bottom = c[k]+(d[k]-c[k])*tx;
+      mix[k] = top+(bottom-top)*ty;
+   }
+   toFill[0] = (unsigned char)(mix[0]+.5);
+   toFill[1] = (unsigned char)(mix[1]+.5);
+   toFill[2] = (unsigned char)(mix[2]+.5);
+   *op = mix[3]*opacity * over255;
    *ref = reflection;
    *am = ambient;
 }
 
+void ImageTexture::prepare(){
+   unsigned int levels = 1;
+   for(unsigned int lw = w, lh = h; lw > 1 || lh > 1; levels++){
+      lw = (lw > 1) ? lw/2 : 1;
+      lh = (lh > 1) ? lh/2 : 1;
+   }
+   mips = (MipLevel*)malloc(levels*sizeof(MipLevel));
+   numMips = levels;
+   for(unsigned int i = 0; i<levels; i++){
+      MipLevel& l = mips[i];
+      if(i == 0){
+         l.w = w;
+         l.h = h;
+      } else {
+         l.w = (mips[i-1].w > 1) ? mips[i-1].w/2 : 1;
+         l.h = (mips[i-1].h > 1) ? mips[i-1].h/2 : 1;
+      }
+      l.tilesX = (l.w+TEXTURE_TILE-1)/TEXTURE_TILE;
+      const unsigned int tilesY = (l.h+TEXTURE_TILE-1)/TEXTURE_TILE;
+      l.data = (unsigned char*)calloc(4*l.tilesX*tilesY*TEXTURE_TILE*TEXTURE_TILE, sizeof(unsigned char));
+      for(unsigned int y = 0; y<l.h; y++)
+         for(unsigned int x = 0; x<l.w; x++){
+            unsigned char* out = (unsigned char*)texel(l, x, y);
+            if(i == 0){
+               for(int k = 0; k<4; k++) out[k] = imageData[4*(x+w*y)+k];
+               continue;
+            }
+            // Box filter the 2x2 (fewer at an odd edge) texels above
+            const MipLevel& p = mips[i-1];
+            const unsigned int xa = 2*x, xb = (2*x+1 < p.w) ? 2*x+1 : 2*x;
+            const unsigned int ya = 2*y, yb = (2*y+1 < p.h) ? 2*y+1 : 2*y;
+            const unsigned char* a = texel(p, xa, ya);
+            const unsigned char* b = texel(p, xb, ya);
+            const unsigned char* c = texel(p, xa, yb);
+            const unsigned char* d = texel(p, xb, yb);
+            for(int k = 0; k<4; k++) out[k] = (unsigned char)((a[k]+b[k]+c[k]+d[k]+2)/4);
+         }
+   }
+}
+
 void ImageTexture::maskImageAlpha(){
 int x,y;
 #pragma omp parallel for
@@ -162,14 +251,14 @@ unsigned char* ImageTexture::setColor(unsigned int x, unsigned int y, unsigned c
    return &imageData[start];
 }
 
-ImageTexture::ImageTexture(unsigned int ww, unsigned int hh):Texture(.3, 1., 0.){
+ImageTexture::ImageTexture(unsigned int ww, unsigned int hh):Texture(.3, 1., 0.), mips(NULL), numMips(0){
    w =ww;
    h = hh;
    imageData = (unsigned char*)malloc(4*w*h*sizeof(unsigned char));
    int i;
    for(i = 0; i<w*h; i++){ imageData[i*4+3] = 255; }
 } 
-ImageTexture::ImageTexture(unsigned char* data, unsigned int ww, unsigned int hh):Texture(.3, 1., 0.){
+ImageTexture::ImageTexture(unsigned char* data, unsigned int ww, unsigned int hh):Texture(.3, 1., 0.), mips(NULL), numMips(0){
    imageData = data;
    w =ww;
    h = hh;
@@ -279,7 +368,58 @@ void ImageTexture::readPPM(FILE* f, const char* file){
 
 
 }
-ImageTexture::ImageTexture(const char* file):Texture(.3, 1., 0.){
+// OPTIM: decode in process with stb_image instead of piping through an
+// ImageMagick process. Rows are flipped like readPPM and alpha is dropped,
+// as it was in the ppm that magick produced.
+void ImageTexture::decode(const char* file){
+   int iw, ih, channels;
+   unsigned char* rgb = stbi_load(file, &iw, &ih, &channels, 3);
+   if (rgb == NULL){
+      printf("File loading error!!! %s %s\n", file, stbi_failure_reason());
+      exit(0);
+   }
+   w = iw;
+   h = ih;
+   imageData = (unsigned char*)malloc(4*w*h*(sizeof(unsigned char)));
+   for(unsigned int r = 0; r<h; r++){
+      const unsigned char* row = &rgb[3*w*r];
+      unsigned char* out = &imageData[4*w*(h-1-r)];
+      for(unsigned int x = 0; x<w; x++){
+         out[4*x] = row[3*x];
+         out[4*x+1] = row[3*x+1];
+         out[4*x+2] = row[3*x+2];
+         out[4*x+3] = 255;
+      }
+   }
+   stbi_image_free(rgb);
+}
+
+// OPTIM: one decoded buffer per image file (and per masking), shared by
+// every texture made from it
+struct CachedImage {
+   std::string path;
+   bool masked;
+   unsigned char* data;
+   unsigned int w, h;
+   MipLevel* mips;
+   unsigned int numMips;
+};
+static std::vector<CachedImage> imageCache;
+
+ImageTexture::ImageTexture(const char* file):ImageTexture(file, false){}
+
+ImageTexture::ImageTexture(const char* file, bool maskAlpha):Texture(.3, 1., 0.){
+   for(const CachedImage& c : imageCache){
+      if(c.masked == maskAlpha && c.path == file){
+         imageData = c.data;
+         w = c.w;
+         h = c.h;
+         mips = c.mips;
+         numMips = c.numMips;
+         return;
+      }
+   }
+
    const char* ext = findExtension(file);
    if(extensionEquals(ext, "ppm")){
    
@@ -288,12 +428,10 @@ ImageTexture::ImageTexture(const char* file):Texture(.3, 1., 0.){
       fclose(f);
    }
    else{
-      char command[2000];
-      snprintf(command, sizeof(command), "magick %s ppm:-", file);
-      FILE* f = popen(command, "r");
-      readPPM(f, file);
-      pclose(f);
+      decode(file);
    }
-
-
+   if(maskAlpha)
+      maskImageAlpha();
+   prepare();
+   imageCache.push_back({file, maskAlpha, imageData, w, h, mips, numMips});
 }
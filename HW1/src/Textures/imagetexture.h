@@ -2,19 +2,40 @@
 #define __IMAGE_TEXTURE_H__
 #include "colortexture.h"
 
+// One level of the mip chain, RGBA in TEXTURE_TILE x TEXTURE_TILE blocks
+// (one cache line each) so a 2D neighbourhood is a few lines, not rows
+// that are a whole image width apart.
+struct MipLevel {
+   unsigned int w, h, tilesX;
+   unsigned char* data;
+};
+#define TEXTURE_TILE 4
+
 class ImageTexture: public Texture{
 /** from 0 to 1 **/
 public:
    unsigned int w, h;
+   // Row major RGBA, what setColor and the maskImage calls edit
    unsigned char* imageData;
+   // OPTIM: what getColor samples, imageData retiled plus its mip chain.
+   // Built by prepare(), which has to run again after editing imageData.
+   MipLevel* mips;
+   unsigned int numMips;
+   void prepare();
    void getColor(unsigned char* toFill, double* am, double* op, double* ref, double x, double y);
+   // Bilinear lookup in the mip level whose texels are about footprint wide
+   void getFilteredColor(unsigned char* toFill, double* am, double* op, double* ref, double x, double y, double footprint);
    void getColor(unsigned char* toFill, double* am, double *op, double* ref, unsigned int x, unsigned int y);
    ImageTexture(unsigned char* data, unsigned int ww, unsigned int hh);
    ImageTexture(unsigned int ww, unsigned int hh);
    ImageTexture(const char* file);
+   // Pixels are shared with every other texture loaded from the same file
+   // (with the same maskAlpha), so they must not be modified afterwards
+   ImageTexture(const char* file, bool maskAlpha);
    unsigned char* setColor(unsigned int x, unsigned int y, unsigned char* data);
    unsigned char* setColor(unsigned int x, unsigned int y, unsigned char r, unsigned char g, unsigned char b);
    void readPPM(FILE* f, const char* file);
+   void decode(const char* file);
    void maskImage(unsigned char r, unsigned char g, unsigned char b);
    void maskImage(unsigned char r, unsigned char g, unsigned char b, unsigned char rm, unsigned char gm, unsigned char mb,unsigned char m);
    void maskImage(unsigned char r, unsigned char g, unsigned char b, unsigned char m);
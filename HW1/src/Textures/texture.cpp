@@ -8,6 +8,10 @@ double interpolate(double a,double b,double x)
 
 Texture::Texture(double am, double op, double ref):ambient(am),opacity(op), reflection(ref){}
 
+void Texture::getFilteredColor(unsigned char* toFill, double* am, double *op, double *ref, double x, double y, double footprint){
+   getColor(toFill, am, op, ref, x, y);
+}
+
 
 double fix(double a) {
    // OPTIM: wtf was this function even doing
@@ -14,6 +14,9 @@ public:
    double opacity, reflection, ambient;
    Texture(double am, double op, double ref);
    virtual void getColor(unsigned char* toFill, double* am, double *opacity, double *reflection,double x, double y) = 0;
+   // Same lookup for a sample covering about footprint x footprint of the
+   // texture (0 for a point sample). Textures without detail ignore it.
+   virtual void getFilteredColor(unsigned char* toFill, double* am, double *opacity, double *reflection, double x, double y, double footprint);
    Texture* clone();
 };
 
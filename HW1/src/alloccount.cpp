@@ -0,0 +1,90 @@
+#include "alloccount.h"
+#include <atomic>
+#include <errno.h>
+#include <stddef.h>
+
+// Replacements for the malloc family. They forward to glibc's own allocator
+// and only bump a counter, which stays uncontended as long as nobody
+// allocates. Being malloc itself they also see operator new (libstdc++
+// forwards to malloc), libgomp's team setup and libc internals such as
+// fopen. glibc supports replacing malloc this way as long as the whole family
+// is replaced together.
+
+static std::atomic<unsigned long long> allocations(0);
+// Initial exec TLS of the executable, safe to touch from inside malloc
+static thread_local int uncounted = 0;
+
+unsigned long long allocCount() {
+   return allocations.load(std::memory_order_relaxed);
+}
+
+UncountedAllocs::UncountedAllocs() { uncounted++; }
+UncountedAllocs::~UncountedAllocs() { uncounted--; }
+
+static inline void count() {
+   if (!uncounted) allocations.fetch_add(1, std::memory_order_relaxed);
+}
+
+extern "C" {
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t n, size_t size);
+void* __libc_realloc(void* p, size_t size);
+void* __libc_memalign(size_t align, size_t size);
+void* __libc_valloc(size_t size);
+void* __libc_pvalloc(size_t size);
+void __libc_free(void* p);
+
+void* malloc(size_t size) noexcept {
+   count();
+   return __libc_malloc(size);
+}
+
+void* calloc(size_t n, size_t size) noexcept {
+   count();
+   return __libc_calloc(n, size);
+}
+
+void* realloc(void* p, size_t size) noexcept {
+   count();
+   return __libc_realloc(p, size);
+}
+
+void* reallocarray(void* p, size_t n, size_t size) noexcept {
+   if (size && n > (size_t)-1 / size) {
+      errno = ENOMEM;
+      return NULL;
+   }
+   return realloc(p, n * size);
+}
+
+void* memalign(size_t align, size_t size) noexcept {
+   count();
+   return __libc_memalign(align, size);
+}
+
+void* aligned_alloc(size_t align, size_t size) noexcept {
+   return memalign(align, size);
+}
+
+int posix_memalign(void** out, size_t align, size_t size) noexcept {
+   if (align % sizeof(void*) != 0 || (align & (align - 1)) != 0) return EINVAL;
+   void* p = memalign(align, size);
+   if (p == NULL) return ENOMEM;
+   *out = p;
+   return 0;
+}
+
+void* valloc(size_t size) noexcept {
+   count();
+   return __libc_valloc(size);
+}
+
+void* pvalloc(size_t size) noexcept {
+   count();
+   return __libc_pvalloc(size);
+}
+
+void free(void* p) noexcept {
+   __libc_free(p);
+}
+}
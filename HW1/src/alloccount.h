@@ -0,0 +1,17 @@
+#ifndef __ALLOCCOUNT_H__
+#define __ALLOCCOUNT_H__
+
+// Number of heap allocations (malloc, calloc, realloc, aligned allocations,
+// and through them every new expression and std container) made by the
+// program so far, from any thread
+unsigned long long allocCount();
+
+// While one is alive, allocations made on this thread are not counted. For
+// work that runs next to rendering but is not part of it, like writing out
+// finished frames.
+struct UncountedAllocs {
+   UncountedAllocs();
+   ~UncountedAllocs();
+};
+
+#endif
@@ -0,0 +1,41 @@
+#include "animation.h"
+#include "shape.h"
+#include "bvh.h"
+
+void Animation::apply(Autonoma* scene, int frame, int frameLen) {
+   bool moved = false;
+   for (const AnimTrack& t : tracks) {
+      const double result = t.func((double)frame / frameLen, t.from, t.to);
+      if (t.shapeIndex < 0) {
+         Camera& camera = scene->camera;
+         switch (t.field) {
+         case ANIM_YAW: camera.setYaw(result); break;
+         case ANIM_PITCH: camera.setPitch(result); break;
+         case ANIM_ROLL: camera.setRoll(result); break;
+         case ANIM_X: camera.focus.x = result; break;
+         case ANIM_Y: camera.focus.y = result; break;
+         case ANIM_Z: camera.focus.z = result; break;
+         default: break;
+         }
+         continue;
+      }
+      Shape* shape = scene->shapes[t.shapeIndex];
+      switch (t.field) {
+      case ANIM_YAW: shape->setYaw(result); break;
+      case ANIM_PITCH: shape->setPitch(result); break;
+      case ANIM_ROLL: shape->setRoll(result); break;
+      case ANIM_TEXTURE_X: shape->textureX = result; break;
+      case ANIM_TEXTURE_Y: shape->textureY = result; break;
+      case ANIM_MAP_X: shape->mapX = result; break;
+      case ANIM_MAP_Y: shape->mapY = result; break;
+      case ANIM_MAP_OFF_X: shape->mapOffX = result; break;
+      case ANIM_MAP_OFF_Y: shape->mapOffY = result; break;
+      default: break;
+      }
+      if (t.field <= ANIM_ROLL) {
+         scene->bvh->markDirty(t.shapeIndex);
+         moved = true;
+      }
+   }
+   if (moved) scene->bvh->refitDirty();
+}
@@ -0,0 +1,33 @@
+#ifndef __ANIMATION_H__
+#define __ANIMATION_H__
+#include <vector>
+#include "light.h"
+
+enum AnimField {
+   // Orientation, the only fields that move a shape's bounds
+   ANIM_YAW, ANIM_PITCH, ANIM_ROLL,
+   // Camera position
+   ANIM_X, ANIM_Y, ANIM_Z,
+   // Shape texture mapping
+   ANIM_TEXTURE_X, ANIM_TEXTURE_Y, ANIM_MAP_X, ANIM_MAP_Y, ANIM_MAP_OFF_X, ANIM_MAP_OFF_Y
+};
+
+// One line of an .animate file with its names already resolved
+struct AnimTrack {
+   double (*func)(double x, double from, double to);
+   double from, to;
+   // Index into Autonoma::shapes, -1 when the track drives the camera
+   int shapeIndex;
+   AnimField field;
+};
+
+// OPTIM: The animation script compiled once into typed tracks. Each frame
+// only evaluates the tracks and refits the BVH nodes above the shapes that
+// were rotated, instead of reparsing the file and refitting the whole tree.
+class Animation {
+public:
+   std::vector<AnimTrack> tracks;
+   void apply(Autonoma* scene, int frame, int frameLen);
+};
+
+#endif
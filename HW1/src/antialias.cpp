@@ -0,0 +1,37 @@
+#include "antialias.h"
+#include <math.h>
+#include <stdlib.h>
+
+static inline int contrast(const unsigned char* a, const unsigned char* b) {
+   return abs(a[0]-b[0])+abs(a[1]-b[1])+abs(a[2]-b[2]);
+}
+
+int findEdges(const unsigned char* data, Shape* const* ids, unsigned char* edges, int w, int h, int y0, int y1) {
+   int count = 0;
+   for (int j = y0; j<y1; ++j)
+      for (int i = 0; i<w; ++i) {
+         const int p = i+j*w;
+         const unsigned char* c = &data[3*p];
+         // Checked both ways so an edge is refined on either side of it
+         bool edge = false;
+         if (i > 0) edge |= ids[p-1] != ids[p] || contrast(c, c-3) > AA_CONTRAST;
+         if (i+1 < w) edge |= ids[p+1] != ids[p] || contrast(c, c+3) > AA_CONTRAST;
+         if (j > 0) edge |= ids[p-w] != ids[p] || contrast(c, c-3*w) > AA_CONTRAST;
+         if (j+1 < h) edge |= ids[p+w] != ids[p] || contrast(c, c+3*w) > AA_CONTRAST;
+         edges[p] = edge;
+         count += edge;
+      }
+   return count;
+}
+
+void aaOffset(int pixel, int k, double* dx, double* dy) {
+   // Integer hash of the pixel for where it starts the sequence
+   unsigned int s = (unsigned int)pixel*0x9E3779B1u;
+   s ^= s >> 15;
+   s *= 0x85EBCA77u;
+   s ^= s >> 13;
+   const double sx = (s & 0xFFFF)*(1./65536), sy = (s >> 16)*(1./65536);
+   const double x = sx+k*0.7548776662466927, y = sy+k*0.5698402909980532;
+   *dx = x-floor(x)-.5;
+   *dy = y-floor(y)-.5;
+}
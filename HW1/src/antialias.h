@@ -0,0 +1,25 @@
+#ifndef __ANTIALIAS_H__
+#define __ANTIALIAS_H__
+
+class Shape;
+
+// OPTIM: Adaptive antialiasing. After the one ray per pixel pass, only
+// pixels on an edge (another shape hit by a neighbour, or a color jump) get
+// extra jittered camera rays, as many as the frame's ray budget allows.
+
+// Camera rays an edge pixel gets at most, its first one included
+#define AA_MAX_SAMPLES 16
+// Summed RGB difference to a neighbour that makes a pixel an edge
+#define AA_CONTRAST 24
+
+// Sets edges[p] for the pixels p of rows [y0, y1) of a w x h frame that are
+// on an edge, from the colors in data and the shapes in ids. Returns how
+// many were set.
+int findEdges(const unsigned char* data, Shape* const* ids, unsigned char* edges, int w, int h, int y0, int y1);
+
+// Jittered offset in [-.5, .5) x [-.5, .5) of extra sample k >= 1 of
+// pixel. Samples of a pixel follow the R2 sequence so they spread evenly,
+// each pixel starting it somewhere else.
+void aaOffset(int pixel, int k, double* dx, double* dy);
+
+#endif
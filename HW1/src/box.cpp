@@ -30,4 +30,22 @@ bool Box::getLightIntersection(Ray ray, double* fill){
    fill[1]*=temp[1] * over255;
    fill[2]*=temp[2] * over255;
    return false;
+}
+
+bool Box::getBounds(Vector& min, Vector& max){
+   const double hx = textureX * over2, hy = textureY * over2;
+   Vector ext(fabs(hx*right.x)+fabs(hy*up.x)+1e-6,
+              fabs(hx*right.y)+fabs(hy*up.y)+1e-6,
+              fabs(hx*right.z)+fabs(hy*up.z)+1e-6);
+   min = center-ext;
+   max = center+ext;
+   return true;
+}
+
+ShapeKind Box::kind(){
+   return SHAPE_BOX;
+}
+
+Shape* Box::clone(){
+   return new Box(*this);
 }
\ No newline at end of file
@@ -8,6 +8,9 @@ public:
   Box(const Vector &c, Texture* t, double ya, double pi, double ro, double tx);
   double getIntersection(Ray ray);
   bool getLightIntersection(Ray ray, double* fill);
+  bool getBounds(Vector& min, Vector& max);
+  ShapeKind kind();
+  Shape* clone();
 };
 
 #endif
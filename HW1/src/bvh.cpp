@@ -0,0 +1,358 @@
+#include "bvh.h"
+#include "shapedispatch.h"
+#include <algorithm>
+#include <functional>
+
+constexpr int BVH_BINS = 16;
+constexpr int BVH_LEAF_SIZE = 4;
+// Past this depth only median splits are made, which bounds the depth of
+// degenerate inputs to about BVH_SAH_DEPTH + log2(prims). Anything still
+// deeper than the traversal stack allows ends in one large leaf.
+constexpr int BVH_SAH_DEPTH = 40;
+static_assert(BVH_SAH_DEPTH < BVH_STACK_SIZE - 1, "SAH splits must fit the traversal stack");
+
+namespace {
+
+struct AABB {
+   double min_v[3], max_v[3];
+   AABB() {
+      for (int k = 0; k < 3; k++) { min_v[k] = inf; max_v[k] = -inf; }
+   }
+   void grow(const double* lo, const double* hi) {
+      for (int k = 0; k < 3; k++) {
+         if (lo[k] < min_v[k]) min_v[k] = lo[k];
+         if (hi[k] > max_v[k]) max_v[k] = hi[k];
+      }
+   }
+   double area() const {
+      if (min_v[0] > max_v[0]) return 0;
+      const double dx = max_v[0] - min_v[0], dy = max_v[1] - min_v[1], dz = max_v[2] - min_v[2];
+      return dx * dy + dy * dz + dz * dx;
+   }
+};
+
+int buildNodes(std::vector<BVHNode>& nodes, std::vector<double>& bounds, std::vector<int>& order,
+               int start, int count, int depth);
+
+// Stable sort of [start, start+count) by kind, shapes and index move along
+void groupByKind(std::vector<Shape*>& shapes, std::vector<int>& index, std::vector<unsigned char>& kind,
+                 int start, int count) {
+   std::vector<int> sel(count);
+   for (int i = 0; i < count; i++) sel[i] = start + i;
+   std::stable_sort(sel.begin(), sel.end(), [&](int a, int b) { return kind[a] < kind[b]; });
+   std::vector<Shape*> s(count);
+   std::vector<int> x(count);
+   std::vector<unsigned char> k(count);
+   for (int i = 0; i < count; i++) {
+      s[i] = shapes[sel[i]];
+      x[i] = index[sel[i]];
+      k[i] = kind[sel[i]];
+   }
+   std::copy(s.begin(), s.end(), shapes.begin() + start);
+   std::copy(x.begin(), x.end(), index.begin() + start);
+   std::copy(k.begin(), k.end(), kind.begin() + start);
+}
+
+}
+
+void buildBVHNodes(std::vector<BVHNode>& nodes, std::vector<double>& bounds, std::vector<int>& order) {
+   order.resize(bounds.size() / 6);
+   for (size_t i = 0; i < order.size(); i++) order[i] = i;
+   nodes.clear();
+   if (order.empty()) return;
+   nodes.reserve(2 * order.size());
+   buildNodes(nodes, bounds, order, 0, order.size(), 0);
+}
+
+BVH::BVH(const std::vector<Shape*>& shapes) {
+   std::vector<double> bounds;
+   for (size_t i = 0; i < shapes.size(); i++) {
+      Vector lo(0, 0, 0), hi(0, 0, 0);
+      if (shapes[i]->getBounds(lo, hi)) {
+         bounds.insert(bounds.end(), {lo.x, lo.y, lo.z, hi.x, hi.y, hi.z});
+         prims.push_back(shapes[i]);
+         primIndex.push_back(i);
+      } else {
+         unbounded.push_back(shapes[i]);
+         unboundedIndex.push_back(i);
+         unboundedKind.push_back(shapes[i]->kind());
+      }
+   }
+   std::vector<int> order;
+   buildBVHNodes(nodes, bounds, order);
+   std::vector<Shape*> bounded(prims);
+   std::vector<int> boundedIndex(primIndex);
+   for (size_t i = 0; i < order.size(); i++) {
+      prims[i] = bounded[order[i]];
+      primIndex[i] = boundedIndex[order[i]];
+      primKind.push_back(prims[i]->kind());
+   }
+   // OPTIM: group each leaf's prims (and the unbounded list) by kind so the
+   // kind switch in the traversal loops runs the same case back to back
+   for (size_t i = 0; i < nodes.size(); i++)
+      if (nodes[i].count > 0) groupByKind(prims, primIndex, primKind, nodes[i].start, nodes[i].count);
+   groupByKind(unbounded, unboundedIndex, unboundedKind, 0, unbounded.size());
+
+   parent.assign(nodes.size(), -1);
+   dirty.assign(nodes.size(), 0);
+   dirtyNodes.reserve(nodes.size());
+   leafOfShape.assign(shapes.size(), -1);
+   for (size_t i = 0; i < nodes.size(); i++) {
+      if (nodes[i].count > 0) {
+         for (int s = nodes[i].start; s < nodes[i].start + nodes[i].count; s++)
+            leafOfShape[primIndex[s]] = i;
+         continue;
+      }
+      parent[i + 1] = i;
+      parent[nodes[i].start] = i;
+   }
+}
+
+BVH::BVH(const BVH& other, const std::vector<Shape*>& shapes) : BVH(other) {
+   for (size_t i = 0; i < prims.size(); i++) prims[i] = shapes[primIndex[i]];
+   for (size_t i = 0; i < unbounded.size(); i++) unbounded[i] = shapes[unboundedIndex[i]];
+   // Copying a vector drops its spare capacity
+   dirtyNodes.reserve(nodes.size());
+}
+
+namespace {
+
+// bounds holds 6 doubles per prim and is permuted together with order
+int buildNodes(std::vector<BVHNode>& nodes, std::vector<double>& bounds, std::vector<int>& order,
+               int start, int count, int depth) {
+   const int idx = nodes.size();
+   nodes.push_back(BVHNode());
+   AABB box, cbox;
+   for (int i = start; i < start + count; i++) {
+      const double* b = &bounds[6 * i];
+      box.grow(b, b + 3);
+      double c[3] = {(b[0] + b[3]) * .5, (b[1] + b[4]) * .5, (b[2] + b[5]) * .5};
+      cbox.grow(c, c);
+   }
+   std::copy(box.min_v, box.min_v + 3, nodes[idx].min_v);
+   std::copy(box.max_v, box.max_v + 3, nodes[idx].max_v);
+   nodes[idx].start = start;
+   nodes[idx].count = count;
+   if (count <= 1 || depth >= BVH_STACK_SIZE - 1) return idx;
+
+   int axis = 0;
+   for (int k = 1; k < 3; k++)
+      if (cbox.max_v[k] - cbox.min_v[k] > cbox.max_v[axis] - cbox.min_v[axis]) axis = k;
+   const double lo = cbox.min_v[axis], extent = cbox.max_v[axis] - lo;
+   if (extent <= 0 && count <= BVH_LEAF_SIZE) return idx;
+
+   // OPTIM: binned surface area heuristic
+   int split = -1;
+   double bestCost = inf;
+   if (extent > 0 && depth < BVH_SAH_DEPTH) {
+      AABB bins[BVH_BINS];
+      int binCount[BVH_BINS] = {0};
+      const double scale = BVH_BINS / extent;
+      for (int i = start; i < start + count; i++) {
+         const double* b = &bounds[6 * i];
+         int bin = (int)(((b[axis] + b[axis + 3]) * .5 - lo) * scale);
+         if (bin >= BVH_BINS) bin = BVH_BINS - 1;
+         bins[bin].grow(b, b + 3);
+         binCount[bin]++;
+      }
+      double rightArea[BVH_BINS];
+      int rightCount[BVH_BINS];
+      AABB acc;
+      int n = 0;
+      for (int i = BVH_BINS - 1; i > 0; i--) {
+         acc.grow(bins[i].min_v, bins[i].max_v);
+         n += binCount[i];
+         rightArea[i] = acc.area();
+         rightCount[i] = n;
+      }
+      acc = AABB();
+      n = 0;
+      for (int i = 0; i < BVH_BINS - 1; i++) {
+         acc.grow(bins[i].min_v, bins[i].max_v);
+         n += binCount[i];
+         if (n == 0 || rightCount[i + 1] == 0) continue;
+         const double cost = acc.area() * n + rightArea[i + 1] * rightCount[i + 1];
+         if (cost < bestCost) {
+            bestCost = cost;
+            split = i;
+         }
+      }
+      if (count <= BVH_LEAF_SIZE && bestCost >= box.area() * count) return idx;
+   }
+
+   // Partition prims (and their bounds) around the chosen plane, falling back
+   // to a median split when all centroids land in one bin.
+   std::vector<int> sel(count);
+   for (int i = 0; i < count; i++) sel[i] = start + i;
+   auto centroid = [&](int i) { return bounds[6 * i + axis] + bounds[6 * i + axis + 3]; };
+   int mid;
+   if (split >= 0) {
+      const double plane = 2 * (lo + (split + 1) * extent / BVH_BINS);
+      mid = std::partition(sel.begin(), sel.end(), [&](int i) { return centroid(i) < plane; }) - sel.begin();
+   } else {
+      mid = count / 2;
+      std::nth_element(sel.begin(), sel.begin() + mid, sel.end(),
+                       [&](int a, int b) { return centroid(a) < centroid(b); });
+   }
+   if (mid == 0 || mid == count) mid = count / 2;
+
+   std::vector<int> tmpOrder(count);
+   std::vector<double> tmpBounds(6 * count);
+   for (int i = 0; i < count; i++) {
+      tmpOrder[i] = order[sel[i]];
+      std::copy(&bounds[6 * sel[i]], &bounds[6 * sel[i]] + 6, &tmpBounds[6 * i]);
+   }
+   std::copy(tmpOrder.begin(), tmpOrder.end(), order.begin() + start);
+   std::copy(tmpBounds.begin(), tmpBounds.end(), bounds.begin() + 6 * start);
+
+   nodes[idx].count = 0;
+   buildNodes(nodes, bounds, order, start, mid, depth + 1);
+   const int right = buildNodes(nodes, bounds, order, start + mid, count - mid, depth + 1);
+   nodes[idx].start = right;
+   return idx;
+}
+
+}
+
+void BVH::refitLeaf(BVHNode& node) {
+   AABB box;
+   for (int i = node.start; i < node.start + node.count; i++) {
+      Vector lo(0, 0, 0), hi(0, 0, 0);
+      prims[i]->getBounds(lo, hi);
+      double l[3] = {lo.x, lo.y, lo.z}, h[3] = {hi.x, hi.y, hi.z};
+      box.grow(l, h);
+   }
+   std::copy(box.min_v, box.min_v + 3, node.min_v);
+   std::copy(box.max_v, box.max_v + 3, node.max_v);
+}
+
+void BVH::refitNode(int i) {
+   BVHNode& node = nodes[i];
+   if (node.count > 0) {
+      refitLeaf(node);
+      return;
+   }
+   const BVHNode& l = nodes[i + 1];
+   const BVHNode& r = nodes[node.start];
+   for (int k = 0; k < 3; k++) {
+      node.min_v[k] = std::min(l.min_v[k], r.min_v[k]);
+      node.max_v[k] = std::max(l.max_v[k], r.max_v[k]);
+   }
+}
+
+void BVH::refit() {
+   // Children always come after their parent, so a reverse sweep is bottom-up
+   for (int i = (int)nodes.size() - 1; i >= 0; i--)
+      refitNode(i);
+}
+
+void BVH::markDirty(int shapeIndex) {
+   for (int n = leafOfShape[shapeIndex]; n >= 0 && !dirty[n]; n = parent[n]) {
+      dirty[n] = 1;
+      dirtyNodes.push_back(n);
+   }
+}
+
+void BVH::refitDirty() {
+   // Same bottom-up order as refit(), restricted to the marked paths
+   std::sort(dirtyNodes.begin(), dirtyNodes.end(), std::greater<int>());
+   for (int n : dirtyNodes) {
+      refitNode(n);
+      dirty[n] = 0;
+   }
+   dirtyNodes.clear();
+}
+
+Shape* BVH::intersect(Ray ray, double* time, unsigned int* prim) {
+   double best = inf;
+   int bestIdx = -1;
+   Shape* bestShape = NULL;
+   unsigned int p;
+   *prim = 0;
+
+   for (size_t i = 0; i < unbounded.size(); i++) {
+      const double t = kindIntersection(unbounded[i], unboundedKind[i], ray, &p);
+      if (t > 0 && t != inf && (t < best || (t == best && unboundedIndex[i] < bestIdx))) {
+         best = t;
+         bestIdx = unboundedIndex[i];
+         bestShape = unbounded[i];
+         *prim = p;
+      }
+   }
+
+   if (!nodes.empty()) {
+      const double org[3] = {ray.point.x, ray.point.y, ray.point.z};
+      const double inv[3] = {1 / ray.vector.x, 1 / ray.vector.y, 1 / ray.vector.z};
+      int stack[BVH_STACK_SIZE];
+      int sp = 0;
+      double tnear;
+      const bool hit = bvhHitBox(nodes[0], org, inv, best, &tnear);
+      STAT_SCENE_BOX(this, nodes[0], hit);
+      if (hit) stack[sp++] = 0;
+      while (sp > 0) {
+         const BVHNode& node = nodes[stack[--sp]];
+         if (node.count > 0) {
+            for (int i = node.start; i < node.start + node.count; i++) {
+               const double t = kindIntersection(prims[i], primKind[i], ray, &p);
+               if (t > 0 && t != inf && (t < best || (t == best && primIndex[i] < bestIdx))) {
+                  best = t;
+                  bestIdx = primIndex[i];
+                  bestShape = prims[i];
+                  *prim = p;
+               }
+            }
+            continue;
+         }
+         // OPTIM: visit the nearer child first so best shrinks sooner
+         const int l = &node - &nodes[0] + 1, r = node.start;
+         double tl, tr;
+         const bool hl = bvhHitBox(nodes[l], org, inv, best, &tl);
+         const bool hr = bvhHitBox(nodes[r], org, inv, best, &tr);
+         STAT_SCENE_BOX(this, nodes[l], hl);
+         STAT_SCENE_BOX(this, nodes[r], hr);
+         if (hl && hr) {
+            if (tl < tr) { stack[sp++] = r; stack[sp++] = l; }
+            else { stack[sp++] = l; stack[sp++] = r; }
+         } else if (hl) {
+            stack[sp++] = l;
+         } else if (hr) {
+            stack[sp++] = r;
+         }
+      }
+   }
+
+   *time = best;
+   return bestShape;
+}
+
+bool BVH::occluded(Ray ray, double* fill) {
+   for (size_t i = 0; i < unbounded.size(); i++)
+      if (kindLightIntersection(unbounded[i], unboundedKind[i], ray, fill)) return true;
+
+   if (nodes.empty()) return false;
+   const double org[3] = {ray.point.x, ray.point.y, ray.point.z};
+   const double inv[3] = {1 / ray.vector.x, 1 / ray.vector.y, 1 / ray.vector.z};
+   int stack[BVH_STACK_SIZE];
+   int sp = 0;
+   double tnear;
+   const bool hit = bvhHitBox(nodes[0], org, inv, 1., &tnear);
+   STAT_SCENE_BOX(this, nodes[0], hit);
+   if (hit) stack[sp++] = 0;
+   while (sp > 0) {
+      const BVHNode& node = nodes[stack[--sp]];
+      if (node.count > 0) {
+         for (int i = node.start; i < node.start + node.count; i++)
+            if (kindLightIntersection(prims[i], primKind[i], ray, fill)) return true;
+         continue;
+      }
+      // OPTIM: order does not matter for any-hit, skip the near/far sort
+      const int l = &node - &nodes[0] + 1, r = node.start;
+      const bool hr = bvhHitBox(nodes[r], org, inv, 1., &tnear);
+      STAT_SCENE_BOX(this, nodes[r], hr);
+      if (hr) stack[sp++] = r;
+      const bool hl = bvhHitBox(nodes[l], org, inv, 1., &tnear);
+      STAT_SCENE_BOX(this, nodes[l], hl);
+      if (hl) stack[sp++] = l;
+   }
+   return false;
+}
@@ -0,0 +1,96 @@
+#ifndef __BVH_H__
+#define __BVH_H__
+#include <vector>
+#include "vector.h"
+#include "stats.h"
+
+class Shape;
+
+// OPTIM: Bounding volume hierarchy over the shapes of a scene. Shapes that
+// report bounds (getBounds) go into the tree, the rest (infinite planes) are
+// tested linearly on every ray.
+struct BVHNode {
+   double min_v[3], max_v[3];
+   // Leaf if count > 0 (prims [start, start+count)), otherwise an interior
+   // node whose left child is the next node and right child is node start.
+   int start, count;
+};
+
+// Slab test written so that NaN (0 * inf when the origin lies on a slab)
+// keeps the previous interval, which is the conservative answer.
+__attribute__((always_inline))
+inline bool bvhHitBox(const BVHNode& n, const double* org, const double* inv, double tmax, double* tnear) {
+   double t0 = 0, t1 = tmax;
+   for (int k = 0; k < 3; k++) {
+      double a = (n.min_v[k] - org[k]) * inv[k];
+      double b = (n.max_v[k] - org[k]) * inv[k];
+      if (a > b) { const double t = a; a = b; b = t; }
+      if (a > t0) t0 = a;
+      if (b < t1) t1 = b;
+   }
+   *tnear = t0;
+   return t0 <= t1;
+}
+
+// Size of the fixed stacks the traversals walk the nodes with. A depth first
+// walk holds at most one node more than the depth of the deepest leaf, so
+// the builder turns whatever reaches depth BVH_STACK_SIZE - 1 into a leaf.
+constexpr int BVH_STACK_SIZE = 64;
+
+// Binned SAH build over prims given as 6 doubles (min xyz, max xyz) each.
+// bounds is reordered in place and order[i] is the original prim of slot i.
+void buildBVHNodes(std::vector<BVHNode>& nodes, std::vector<double>& bounds, std::vector<int>& order);
+
+class BVH {
+public:
+   BVH(const std::vector<Shape*>& shapes);
+   // Copy of other over shapes, a copy of the list other was built from
+   BVH(const BVH& other, const std::vector<Shape*>& shapes);
+   // Recompute all boxes bottom-up after shapes moved, keeping the topology
+   void refit();
+   // Record that shape shapeIndex (position in the constructor's list) moved.
+   // refitDirty() then refits only its leaf and that leaf's ancestors.
+   void markDirty(int shapeIndex);
+   void refitDirty();
+   // Closest hit with time > 0, NULL if the ray escapes. Ties go to the shape
+   // added first, matching the old sorted-list behaviour. prim is the face
+   // for meshes (see Shape::getPrimIntersection).
+   Shape* intersect(Ray ray, double* time, unsigned int* prim);
+   // Any-hit query along ray.point + t*ray.vector for t in (0, 1). Returns at
+   // the first opaque occluder; translucent ones tint fill like the old loop.
+   bool occluded(Ray ray, double* fill);
+
+   std::vector<BVHNode> nodes;
+   std::vector<Shape*> prims;
+   std::vector<int> primIndex;
+   std::vector<unsigned char> primKind;
+   std::vector<Shape*> unbounded;
+   std::vector<int> unboundedIndex;
+   std::vector<unsigned char> unboundedKind;
+private:
+   // Per node: parent (-1 for the root) and whether it is queued for refit
+   std::vector<int> parent;
+   std::vector<unsigned char> dirty;
+   std::vector<int> dirtyNodes;
+   // Per shape index: leaf holding it, -1 when unbounded
+   std::vector<int> leafOfShape;
+   void refitLeaf(BVHNode& node);
+   void refitNode(int i);
+};
+
+#ifdef RAY_STATS
+// Counts a test of scene BVH box n, and if it missed a leaf the shapes it
+// kept from being tested
+inline void statSceneBox(const BVH* b, const BVHNode& n, bool hit) {
+   threadStats.nodeTests++;
+   if (hit) return;
+   threadStats.nodeRejections++;
+   for (int i = n.start; i < n.start + n.count; i++) threadStats.leafRejections[b->primKind[i]]++;
+}
+#define STAT_SCENE_BOX(b, n, hit) statSceneBox(b, n, hit)
+#else
+#define STAT_SCENE_BOX(b, n, hit) ((void)0)
+#endif
+#define STAT_MESH_BOX(hit) (STAT_INC(meshNodeTests), STAT_ADD(meshNodeRejections, !(hit)))
+
+#endif
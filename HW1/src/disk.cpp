@@ -27,4 +27,24 @@ bool Disk::getLightIntersection(Ray ray, double* fill){
    fill[1]*=temp[1] * over255;
    fill[2]*=temp[2] * over255;
    return false;
+}
+
+bool Disk::getBounds(Vector& min, Vector& max){
+   // Ellipse with semi-axes textureX*right and textureY*up, padded slightly
+   // since the hit test works in solveScalers coordinates
+   Vector ext(sqrt(textureX*textureX*right.x*right.x+textureY*textureY*up.x*up.x),
+              sqrt(textureX*textureX*right.y*right.y+textureY*textureY*up.y*up.y),
+              sqrt(textureX*textureX*right.z*right.z+textureY*textureY*up.z*up.z));
+   ext += Vector(1e-6, 1e-6, 1e-6);
+   min = center-ext;
+   max = center+ext;
+   return true;
+}
+
+ShapeKind Disk::kind(){
+   return SHAPE_DISK;
+}
+
+Shape* Disk::clone(){
+   return new Disk(*this);
 }
\ No newline at end of file
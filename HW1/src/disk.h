@@ -7,6 +7,9 @@ public:
   Disk(const Vector &c, Texture* t, double ya, double pi, double ro, double tx, double ty);
   double getIntersection(Ray ray);
   bool getLightIntersection(Ray ray, double* fill);
+  bool getBounds(Vector& min, Vector& max);
+  ShapeKind kind();
+  Shape* clone();
 };
 
 #endif
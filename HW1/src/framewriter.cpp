@@ -0,0 +1,101 @@
+#include "framewriter.h"
+#include <stdlib.h>
+
+FrameWriter::FrameWriter(int n, size_t frameSize, WriteFn fn, void* a) :
+    numBuffers(n), freeHead(0), freeCount(n), jobCount(0), nextFrame(0), done(false), write(fn), arg(a) {
+   buffers = (unsigned char**)malloc(numBuffers * sizeof(unsigned char*));
+   freeList = (unsigned char**)malloc(numBuffers * sizeof(unsigned char*));
+   jobData = (unsigned char**)malloc(numBuffers * sizeof(unsigned char*));
+   jobFrame = (int*)malloc(numBuffers * sizeof(int));
+   for (int i = 0; i < numBuffers; i++) {
+      buffers[i] = (unsigned char*)malloc(frameSize);
+      freeList[i] = buffers[i];
+      jobFrame[i] = -1;
+   }
+   worker = std::thread(&FrameWriter::run, this);
+}
+
+FrameWriter::~FrameWriter() {
+   {
+      std::lock_guard<std::mutex> g(lock);
+      done = true;
+   }
+   changed.notify_all();
+   worker.join();
+   for (int i = 0; i < numBuffers; i++) free(buffers[i]);
+   free(buffers);
+   free(freeList);
+   free(jobData);
+   free(jobFrame);
+}
+
+unsigned char* FrameWriter::acquire() {
+   std::unique_lock<std::mutex> g(lock);
+   changed.wait(g, [this] { return freeCount > 0; });
+   unsigned char* data = freeList[freeHead];
+   freeHead = (freeHead + 1) % numBuffers;
+   freeCount--;
+   return data;
+}
+
+void FrameWriter::submit(unsigned char* data, int frame) {
+   {
+      std::lock_guard<std::mutex> g(lock);
+      int slot = 0;
+      while (jobFrame[slot] >= 0) slot++;
+      jobData[slot] = data;
+      jobFrame[slot] = frame;
+      jobCount++;
+   }
+   changed.notify_all();
+}
+
+void FrameWriter::release(unsigned char* data) {
+   {
+      std::lock_guard<std::mutex> g(lock);
+      freeList[(freeHead + freeCount) % numBuffers] = data;
+      freeCount++;
+   }
+   changed.notify_all();
+}
+
+void FrameWriter::run() {
+   while (true) {
+      unsigned char* data;
+      int frame;
+      {
+         std::unique_lock<std::mutex> g(lock);
+         int slot = -1;
+         changed.wait(g, [this, &slot] {
+            for (slot = 0; slot < numBuffers; slot++)
+               if (jobFrame[slot] == nextFrame) return true;
+            return done && jobCount == 0;
+         });
+         if (slot == numBuffers) return;
+         data = jobData[slot];
+         frame = jobFrame[slot];
+         jobFrame[slot] = -1;
+         jobCount--;
+         nextFrame++;
+      }
+      write(data, frame, arg);
+      release(data);
+   }
+}
+
+void writeY4MHeader(FILE* f, int w, int h, int fps) {
+   fprintf(f, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C444\n", w, h, fps);
+}
+
+void writeY4MFrame(FILE* f, const unsigned char* rgb, int w, int h, unsigned char* scratch) {
+   const int n = w * h;
+   unsigned char* y = scratch, *u = scratch + n, *v = scratch + 2 * n;
+   for (int i = 0; i < n; i++) {
+      const int r = rgb[3 * i], g = rgb[3 * i + 1], b = rgb[3 * i + 2];
+      y[i] = (unsigned char)(((66 * r + 129 * g + 25 * b + 128) >> 8) + 16);
+      u[i] = (unsigned char)(((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128);
+      v[i] = (unsigned char)(((112 * r - 94 * g - 18 * b + 128) >> 8) + 128);
+   }
+   fputs("FRAME\n", f);
+   fwrite(scratch, 1, 3 * n, f);
+}
@@ -0,0 +1,54 @@
+#ifndef __FRAMEWRITER_H__
+#define __FRAMEWRITER_H__
+#include <stdio.h>
+#include <stddef.h>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+// OPTIM: Output stage on its own thread. Rendered frames are handed over as
+// whole buffers, so frame k is encoded and written while frame k+1 renders.
+// With numBuffers buffers the renderers run at most numBuffers-1 frames ahead.
+// Frames may be submitted out of order (frame parallel rendering) but are
+// always written in order, starting at frame 0. Renderers must acquire a
+// buffer before picking the frame to render into it, in increasing order:
+// picked the other way round, later frames can hold every buffer while the
+// frame due next waits for one.
+class FrameWriter {
+public:
+   // Called on the writer thread, in frame order
+   typedef void (*WriteFn)(const unsigned char* data, int frame, void* arg);
+   FrameWriter(int numBuffers, size_t frameSize, WriteFn write, void* arg);
+   // Writes out every submitted frame before returning
+   ~FrameWriter();
+   // A buffer that is free to render into, blocks while all are in flight
+   unsigned char* acquire();
+   // Queue a buffer returned by acquire() for writing
+   void submit(unsigned char* data, int frame);
+   // Hand back a buffer returned by acquire() without writing it
+   void release(unsigned char* data);
+private:
+   int numBuffers;
+   unsigned char** buffers;
+   // Ring of free buffers, then submitted (buffer, frame) jobs in any order
+   // (frame -1 marks an empty slot)
+   unsigned char** freeList;
+   int freeHead, freeCount;
+   unsigned char** jobData;
+   int* jobFrame;
+   int jobCount, nextFrame;
+   bool done;
+   WriteFn write;
+   void* arg;
+   std::mutex lock;
+   std::condition_variable changed;
+   std::thread worker;
+   void run();
+};
+
+// In process YUV4MPEG2 output (4:4:4, BT.601 studio range)
+void writeY4MHeader(FILE* f, int w, int h, int fps);
+// scratch must hold 3*w*h bytes
+void writeY4MFrame(FILE* f, const unsigned char* rgb, int w, int h, unsigned char* scratch);
+
+#endif
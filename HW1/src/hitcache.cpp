@@ -0,0 +1,76 @@
+#include "hitcache.h"
+#include "shape.h"
+#include <algorithm>
+
+HitCache::HitCache(Autonoma* scene, int pixels) :
+    hitShape(pixels), hitTime(pixels), hitPrim(pixels), valid(pixels, 0),
+    usable(false), first(true),
+    focus(0, 0, 0), right(0, 0, 0), up(0, 0, 0), forward(0, 0, 0),
+    orientation(3 * scene->shapes.size()), bounds(scene->shapes.size()) {
+   moved.reserve(scene->shapes.size());
+   movedBoxes.reserve(scene->shapes.size());
+}
+
+static bool sameVector(const Vector& a, const Vector& b) {
+   return a.x == b.x && a.y == b.y && a.z == b.z;
+}
+
+void HitCache::beginFrame(Autonoma* scene) {
+   const Camera& cam = scene->camera;
+   usable = !first && sameVector(focus, cam.focus) && sameVector(right, cam.right) &&
+            sameVector(up, cam.up) && sameVector(forward, cam.forward);
+   focus = cam.focus;
+   right = cam.right;
+   up = cam.up;
+   forward = cam.forward;
+
+   moved.clear();
+   movedBoxes.clear();
+   for (size_t i = 0; i < scene->shapes.size(); i++) {
+      Shape* s = scene->shapes[i];
+      BVHNode box;
+      Vector lo(-inf, -inf, -inf), hi(inf, inf, inf);
+      s->getBounds(lo, hi);
+      box.min_v[0] = lo.x; box.min_v[1] = lo.y; box.min_v[2] = lo.z;
+      box.max_v[0] = hi.x; box.max_v[1] = hi.y; box.max_v[2] = hi.z;
+      double* o = &orientation[3 * i];
+      const bool turned = o[0] != s->yaw || o[1] != s->pitch || o[2] != s->roll;
+      if (!first && turned && s->rotationMovesSurface()) {
+         BVHNode both = box;
+         for (int k = 0; k < 3; k++) {
+            both.min_v[k] = std::min(both.min_v[k], bounds[i].min_v[k]);
+            both.max_v[k] = std::max(both.max_v[k], bounds[i].max_v[k]);
+         }
+         moved.push_back(s);
+         movedBoxes.push_back(both);
+      }
+      o[0] = s->yaw; o[1] = s->pitch; o[2] = s->roll;
+      bounds[i] = box;
+   }
+   first = false;
+}
+
+bool HitCache::lookup(int pixel, const Ray& ray, Shape** shape, double* time, unsigned int* prim) const {
+   if (!usable || !valid[pixel]) return false;
+   Shape* s = hitShape[pixel];
+   for (Shape* m : moved)
+      if (m == s) return false;
+   if (!movedBoxes.empty()) {
+      const double org[3] = {ray.point.x, ray.point.y, ray.point.z};
+      const double inv[3] = {1 / ray.vector.x, 1 / ray.vector.y, 1 / ray.vector.z};
+      double tnear;
+      for (const BVHNode& box : movedBoxes)
+         if (bvhHitBox(box, org, inv, hitTime[pixel], &tnear)) return false;
+   }
+   *shape = s;
+   *time = hitTime[pixel];
+   *prim = hitPrim[pixel];
+   return true;
+}
+
+void HitCache::store(int pixel, Shape* shape, double time, unsigned int prim) {
+   hitShape[pixel] = shape;
+   hitTime[pixel] = time;
+   hitPrim[pixel] = prim;
+   valid[pixel] = 1;
+}
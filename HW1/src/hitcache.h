@@ -0,0 +1,36 @@
+#ifndef __HITCACHE_H__
+#define __HITCACHE_H__
+#include <vector>
+#include "light.h"
+#include "bvh.h"
+
+// OPTIM: Primary hit of every pixel from the previous frame. While the camera
+// stays put a pixel keeps its hit unless some shape whose surface moved since
+// then could change it: the hit shape itself, or any shape whose box (old and
+// new position together) the pixel's ray crosses before the hit. Only
+// visibility is reused, shading is always redone.
+class HitCache {
+public:
+   HitCache(Autonoma* scene, int pixels);
+   // Compare the scene with the previous frame, before rendering a frame
+   void beginFrame(Autonoma* scene);
+   // True, with the hit filled in, if the cached hit still holds for ray
+   bool lookup(int pixel, const Ray& ray, Shape** shape, double* time, unsigned int* prim) const;
+   void store(int pixel, Shape* shape, double time, unsigned int prim);
+private:
+   std::vector<Shape*> hitShape;
+   std::vector<double> hitTime;
+   std::vector<unsigned int> hitPrim;
+   std::vector<unsigned char> valid;
+   // Camera unchanged since the previous frame
+   bool usable;
+   bool first;
+   Vector focus, right, up, forward;
+   // Per shape at the previous frame: yaw, pitch, roll and world box
+   std::vector<double> orientation;
+   std::vector<BVHNode> bounds;
+   std::vector<Shape*> moved;
+   std::vector<BVHNode> movedBoxes;
+};
+
+#endif
@@ -0,0 +1,35 @@
+#ifndef __IMAGEENCODER_H__
+#define __IMAGEENCODER_H__
+#include <stddef.h>
+
+struct PNGBand;
+
+// OPTIM: In process image encoding straight from the RGB framebuffer, with
+// every buffer kept from one frame to the next.
+//
+// PNG rows are filtered in parallel, then split into bands that are each
+// deflated on their own thread (zlib). Every band but the last ends on a
+// sync flush, so the band streams simply concatenate into one IDAT.
+//
+// QOI is a single pass with no entropy coder. It is several times faster
+// than even the parallel PNG, at a larger size.
+class ImageEncoder {
+public:
+   // For w x h RGB frames, using up to threads threads
+   ImageEncoder(int w, int h, int threads);
+   ~ImageEncoder();
+   // Threads used from the next call on. The PNG bands stay as the
+   // constructor split them, so the output does not change.
+   void setThreads(int t);
+   // The whole file, valid until the next call. NULL if zlib failed.
+   const unsigned char* png(const unsigned char* rgb, size_t* size);
+   const unsigned char* qoi(const unsigned char* rgb, size_t* size);
+private:
+   int w, h, threads, numBands;
+   // Filtered rows, a filter type byte then 3*w bytes each
+   unsigned char* filtered;
+   PNGBand* bands;
+   unsigned char* out;
+};
+
+#endif
@@ -0,0 +1,103 @@
+#include "instance.h"
+#include "constants.h"
+
+Instance::Instance(const Mesh& source, const Vector& off, Texture* t, double ya, double pi, double ro):
+    Mesh(source), right(1, 0, 0), up(0, 1, 0), vect(0, 0, 1)
+{
+   center = off;
+   texture = t;
+   setAngles(ya, pi, ro);
+}
+
+// Same rotation as Plane: right, up and vect are the turned x, y and z axes
+void Instance::setAxes(){
+   vect.x = xsin*ycos*zcos+ysin*zsin;
+   vect.y = ysin*zcos-xsin*ycos*zsin;
+   vect.z = xcos*ycos;
+   up.x = -xsin*ysin*zcos+ycos*zsin;
+   up.y = ycos*zcos+xsin*ysin*zsin;
+   up.z = -xcos*ysin;
+   right.x = xcos*zcos;
+   right.y = -xcos*zsin;
+   right.z = -xsin;
+}
+
+// The axes are orthonormal, so the inverse rotation is a dot with each.
+// offset is the source mesh's, already baked into the shared faces.
+inline Vector Instance::toMeshDir(const Vector& dir) const {
+   return Vector(dir.dot(right), dir.dot(up), dir.dot(vect));
+}
+
+inline Vector Instance::toMesh(const Vector& point) const {
+   return toMeshDir(point - center) + offset;
+}
+
+// A rigid transform keeps ray.vector's length, so hit times (and the (0, 1)
+// range of light rays) carry over unchanged
+double Instance::getPrimIntersection(Ray ray, unsigned int* prim){
+   return Mesh::getPrimIntersection(Ray(toMesh(ray.point), toMeshDir(ray.vector)), prim);
+}
+
+bool Instance::getLightIntersection(Ray ray, double* fill){
+   return Mesh::getLightIntersection(Ray(toMesh(ray.point), toMeshDir(ray.vector)), fill);
+}
+
+void Instance::getPrimColor(unsigned char* toFill, double* am, double* op, double* ref, Autonoma* r, Ray ray, unsigned int depth, unsigned int prim, double footprint){
+   Mesh::getPrimColor(toFill, am, op, ref, r, Ray(toMesh(ray.point), toMeshDir(ray.vector)), depth, prim, footprint);
+}
+
+Vector Instance::getPrimNormal(Vector point, unsigned int prim){
+   const Vector n = Mesh::getPrimNormal(toMesh(point), prim);
+   return n.x*right+n.y*up+n.z*vect;
+}
+
+void Instance::setAngles(double a, double b, double c){
+   Shape::setAngles(a, b, c);
+   setAxes();
+}
+
+void Instance::setYaw(double a){
+   Shape::setYaw(a);
+   setAxes();
+}
+
+void Instance::setPitch(double b){
+   Shape::setPitch(b);
+   setAxes();
+}
+
+void Instance::setRoll(double c){
+   Shape::setRoll(c);
+   setAxes();
+}
+
+// Box around the turned corners of the mesh's box
+bool Instance::getBounds(Vector& min, Vector& max){
+   if (geom->nodes.empty()) return false;
+   min = Vector(inf, inf, inf);
+   max = Vector(-inf, -inf, -inf);
+   for (int i = 0; i < 8; i++) {
+      const Vector corner((i & 1) ? max_v.x : min_v.x, (i & 2) ? max_v.y : min_v.y, (i & 4) ? max_v.z : min_v.z);
+      const Vector l = corner - offset;
+      const Vector w = l.x*right+l.y*up+l.z*vect+center;
+      if (w.x < min.x) min.x = w.x;
+      if (w.y < min.y) min.y = w.y;
+      if (w.z < min.z) min.z = w.z;
+      if (w.x > max.x) max.x = w.x;
+      if (w.y > max.y) max.y = w.y;
+      if (w.z > max.z) max.z = w.z;
+   }
+   return true;
+}
+
+ShapeKind Instance::kind(){
+   return SHAPE_INSTANCE;
+}
+
+Shape* Instance::clone(){
+   return new Instance(*this);
+}
+
+bool Instance::rotationMovesSurface(){
+   return true;
+}
@@ -0,0 +1,37 @@
+#ifndef __INSTANCE_H__
+#define __INSTANCE_H__
+#include "mesh.h"
+
+// OPTIM: Another placement of an already loaded mesh. It shares the mesh's
+// faces and BVH (MeshGeometry) and only adds a rigid transform: rays are
+// moved into the mesh's space for traversal and normals moved back, so a
+// crowd of copies costs one Instance each instead of a face array and BVH.
+//
+// center is where the origin of the mesh data files goes (like a mesh's
+// offset), turned by yaw / pitch / roll with the same axes as Plane. Texture
+// mapping fields are the instance's own.
+class Instance : public Mesh{
+public:
+   // Mesh space axes in world space
+   Vector right, up, vect;
+
+   Instance(const Mesh& source, const Vector& offset, Texture* t, double yaw, double pitch, double roll);
+   double getPrimIntersection(Ray ray, unsigned int* prim);
+   bool getLightIntersection(Ray ray, double* fill);
+   void getPrimColor(unsigned char* toFill, double* am, double* op, double* ref, Autonoma* r, Ray ray, unsigned int depth, unsigned int prim, double footprint);
+   Vector getPrimNormal(Vector point, unsigned int prim);
+   void setAngles(double a, double b, double c);
+   void setYaw(double a);
+   void setPitch(double b);
+   void setRoll(double c);
+   bool getBounds(Vector& min, Vector& max);
+   ShapeKind kind();
+   Shape* clone();
+   bool rotationMovesSurface();
+private:
+   void setAxes();
+   Vector toMesh(const Vector& point) const;
+   Vector toMeshDir(const Vector& dir) const;
+};
+
+#endif
@@ -5,6 +5,9 @@
 #include "constants.h"
 #include "light.h"
 #include "shape.h"
+#include "bvh.h"
+#include "shadowcache.h"
+#include "stats.h"
 
 Light::Light(const Vector& cente, unsigned char* colo) : center(cente) {
    color = colo;
@@ -19,12 +22,12 @@ unsigned char* Light::getColor(unsigned char a, unsigned char b,
    return r;
 }
 
-Autonoma::Autonoma(const Camera& c) : camera(c) {
+Autonoma::Autonoma(const Camera& c) : camera(c), skyCube(NULL), bvh(NULL), hitCache(NULL), shadowCache(NULL), pixelSpread(0) {
    depth = 10;
    skybox = BLACK;
 }
 
-Autonoma::Autonoma(const Camera& c, Texture* tex) : camera(c) {
+Autonoma::Autonoma(const Camera& c, Texture* tex) : camera(c), skyCube(NULL), bvh(NULL), hitCache(NULL), shadowCache(NULL), pixelSpread(0) {
    depth = 10;
    skybox = tex;
 }
@@ -38,6 +41,22 @@ void Autonoma::removeShape(Shape* s) {
    }
 }
 
+void Autonoma::buildBVH() {
+   delete bvh;
+   bvh = new BVH(shapes);
+}
+
+Autonoma* Autonoma::clone() {
+   Autonoma* a = new Autonoma(camera, skybox);
+   a->depth = depth;
+   a->skyCube = skyCube;
+   a->pixelSpread = pixelSpread;
+   a->lights = lights;
+   for (Shape* s : shapes) a->shapes.push_back(s->clone());
+   if (bvh) a->bvh = new BVH(*bvh, a->shapes);
+   return a;
+}
+
 void Autonoma::addLight(Light* r) { lights.push_back(r); }
 
 void Autonoma::removeLight(Light* l) {
@@ -48,7 +67,7 @@ void Autonoma::removeLight(Light* l) {
 }
 
 void getLight(double* tColor, Autonoma* aut, Vector point, Vector norm,
-              unsigned char flip) {
+              unsigned char flip, const Shape* shape) {
    tColor[0] = tColor[1] = tColor[2] = 0.;
    if (aut->lights.empty()) return;
 
@@ -61,18 +80,20 @@ void getLight(double* tColor, Autonoma* aut, Vector point, Vector norm,
       lightColor[2] = light->color[2] * over255;
 
       Vector ra = light->center - point;
-      bool hit = false;
       Ray shadowRay(point + ra * .01, ra);
 
-      for (size_t shapeIdx = 0; shapeIdx < aut->shapes.size(); ++shapeIdx) {
-         if (aut->shapes[shapeIdx]->getLightIntersection(shadowRay,
-                                                         lightColor)) {
-            hit = true;
-            break;
-         }
+      // OPTIM: any-hit BVH query, stops at the first opaque occluder. Only
+      // lightColor[0] is used below, so that is all the cache keeps.
+      bool occluded;
+      ShadowCache* cache = aut->shadowCache;
+      if (!cache || !cache->lookup(shape, lightIdx, point, &occluded, &lightColor[0])) {
+         STAT_INC(shadowRays);
+         occluded = aut->bvh->occluded(shadowRay, lightColor);
+         if (cache) cache->store(shape, lightIdx, point, occluded, lightColor[0]);
+      } else {
+         STAT_INC(shadowCacheHits);
       }
-
-      if (!hit) {
+      if (!occluded) {
          double perc = (norm.dot(ra) / (ra.mag() * norm.mag()));
          if (flip && perc < 0) perc = -perc;
 
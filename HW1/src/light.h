@@ -15,6 +15,10 @@ public:
 };
 
 class Shape;
+class BVH;
+class HitCache;
+class ShadowCache;
+class SkyCube;
 struct LightNode {
     Light* data;
     LightNode* prev, *next;
@@ -29,11 +33,21 @@ class Autonoma {
 public:
    Camera camera;
    Texture* skybox;
+   // skybox resampled for lookups without atan2, NULL if not built
+   SkyCube* skyCube;
    unsigned int depth;
    
    // OPTIM: Replaced linked lists with vectors
    std::vector<Shape*> shapes;
    std::vector<Light*> lights;
+   // OPTIM: acceleration structure over shapes, (re)built by buildBVH
+   BVH* bvh;
+   // Primary hits kept between frames, NULL unless enabled
+   HitCache* hitCache;
+   // Shadow ray results kept between points and frames, NULL unless enabled
+   ShadowCache* shadowCache;
+   // Angle between neighbouring primary rays, 0 unless textures are filtered
+   double pixelSpread;
    
    Autonoma(const Camera& c);
    Autonoma(const Camera& c, Texture* tex);
@@ -42,8 +56,13 @@ public:
    void removeShape(Shape* s);
    void addLight(Light* l);
    void removeLight(Light* l);
+   void buildBVH();
+   // Scene for rendering another frame concurrently. Shapes and the BVH are
+   // copied, lights, textures, the sky cube and mesh geometry are shared.
+   Autonoma* clone();
 };
 
-void getLight(double* toFill, Autonoma* aut, Vector point, Vector norm, unsigned char r);
+// shape is the one point lies on, it keys the shadow cache
+void getLight(double* toFill, Autonoma* aut, Vector point, Vector norm, unsigned char r, const Shape* shape);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,281 @@
+#include "mesh.h"
+#include "constants.h"
+
+Mesh::Mesh(float* pts, unsigned int np, unsigned int* idx, unsigned int nf, const Vector& off, Texture* t):
+    Shape(off, t, 0., 0., 0.),
+    numPoints(np), numFaces(nf), points(pts), indices(idx), offset(off),
+    min_v(inf, inf, inf), max_v(-inf, -inf, -inf)
+{
+   geom = new MeshGeometry();
+   std::vector<BVHNode>& nodes = geom->nodes;
+   textureX = textureY = mapX = mapY = 1.;
+   mapOffX = mapOffY = 0.;
+   normalMap = NULL;
+   setAngles(0., 0., 0.);
+
+   std::vector<double> bounds(6 * (size_t)numFaces);
+   for (unsigned int f = 0; f < numFaces; f++) {
+      for (int k = 0; k < 3; k++) {
+         double lo = inf, hi = -inf;
+         const double o = (k == 0) ? offset.x : ((k == 1) ? offset.y : offset.z);
+         for (int c = 0; c < 3; c++) {
+            const double p = points[3 * indices[3 * f + c] + k] + o;
+            if (p < lo) lo = p;
+            if (p > hi) hi = p;
+         }
+         bounds[6 * f + k] = lo;
+         bounds[6 * f + k + 3] = hi;
+      }
+   }
+   std::vector<int> order;
+   buildBVHNodes(nodes, bounds, order);
+
+   geom->v0x.resize(numFaces); geom->v0y.resize(numFaces); geom->v0z.resize(numFaces);
+   geom->e1x.resize(numFaces); geom->e1y.resize(numFaces); geom->e1z.resize(numFaces);
+   geom->e2x.resize(numFaces); geom->e2y.resize(numFaces); geom->e2z.resize(numFaces);
+   for (unsigned int i = 0; i < numFaces; i++) {
+      const unsigned int* tri = &indices[3 * order[i]];
+      const Vector a = Vector(points[3 * tri[0]], points[3 * tri[0] + 1], points[3 * tri[0] + 2]) + offset;
+      const Vector b = Vector(points[3 * tri[1]], points[3 * tri[1] + 1], points[3 * tri[1] + 2]) + offset;
+      const Vector c = Vector(points[3 * tri[2]], points[3 * tri[2] + 1], points[3 * tri[2] + 2]) + offset;
+      geom->v0x[i] = a.x; geom->v0y[i] = a.y; geom->v0z[i] = a.z;
+      geom->e1x[i] = b.x - a.x; geom->e1y[i] = b.y - a.y; geom->e1z[i] = b.z - a.z;
+      geom->e2x[i] = c.x - a.x; geom->e2y[i] = c.y - a.y; geom->e2z[i] = c.z - a.z;
+   }
+   if (!nodes.empty()) {
+      min_v = Vector(nodes[0].min_v[0], nodes[0].min_v[1], nodes[0].min_v[2]);
+      max_v = Vector(nodes[0].max_v[0], nodes[0].max_v[1], nodes[0].max_v[2]);
+   }
+}
+
+// Moller-Trumbore, returns the hit time (inf on a miss) and the barycentric
+// coordinates of the hit
+__attribute__((always_inline))
+inline double intersectFace(const Mesh* m, unsigned int f, const Ray& ray, double* u, double* v) {
+   const double dx = ray.vector.x, dy = ray.vector.y, dz = ray.vector.z;
+   const double px = dy * m->geom->e2z[f] - dz * m->geom->e2y[f];
+   const double py = dz * m->geom->e2x[f] - dx * m->geom->e2z[f];
+   const double pz = dx * m->geom->e2y[f] - dy * m->geom->e2x[f];
+   const double det = m->geom->e1x[f] * px + m->geom->e1y[f] * py + m->geom->e1z[f] * pz;
+   if (det == 0) return inf; // OPTIM: ray parallel to the face
+   const double inv = 1 / det;
+   const double tx = ray.point.x - m->geom->v0x[f], ty = ray.point.y - m->geom->v0y[f], tz = ray.point.z - m->geom->v0z[f];
+   *u = (tx * px + ty * py + tz * pz) * inv;
+   if (*u < 0 || *u > 1) return inf;
+   const double qx = ty * m->geom->e1z[f] - tz * m->geom->e1y[f];
+   const double qy = tz * m->geom->e1x[f] - tx * m->geom->e1z[f];
+   const double qz = tx * m->geom->e1y[f] - ty * m->geom->e1x[f];
+   *v = (dx * qx + dy * qy + dz * qz) * inv;
+   if (*v < 0 || *u + *v > 1) return inf;
+   return (m->geom->e2x[f] * qx + m->geom->e2y[f] * qy + m->geom->e2z[f] * qz) * inv;
+}
+
+double Mesh::getPrimIntersection(Ray ray, unsigned int* prim){
+   const std::vector<BVHNode>& nodes = geom->nodes;
+   double best = inf;
+   if (nodes.empty()) return best;
+   const double org[3] = {ray.point.x, ray.point.y, ray.point.z};
+   const double inv[3] = {1 / ray.vector.x, 1 / ray.vector.y, 1 / ray.vector.z};
+   int stack[BVH_STACK_SIZE];
+   int sp = 0;
+   double tnear, u, v;
+   const bool hit = bvhHitBox(nodes[0], org, inv, best, &tnear);
+   STAT_MESH_BOX(hit);
+   if (hit) stack[sp++] = 0;
+   while (sp > 0) {
+      const int ni = stack[--sp];
+      const BVHNode& node = nodes[ni];
+      if (node.count > 0) {
+         STAT_ADD(faceTests, node.count);
+         for (int f = node.start; f < node.start + node.count; f++) {
+            const double t = intersectFace(this, f, ray, &u, &v);
+            if (t > 0 && t < best) {
+               best = t;
+               *prim = f;
+            }
+         }
+         continue;
+      }
+      const int l = ni + 1, r = node.start;
+      double tl, tr;
+      const bool hl = bvhHitBox(nodes[l], org, inv, best, &tl);
+      const bool hr = bvhHitBox(nodes[r], org, inv, best, &tr);
+      STAT_MESH_BOX(hl);
+      STAT_MESH_BOX(hr);
+      if (hl && hr) {
+         if (tl < tr) { stack[sp++] = r; stack[sp++] = l; }
+         else { stack[sp++] = l; stack[sp++] = r; }
+      } else if (hl) {
+         stack[sp++] = l;
+      } else if (hr) {
+         stack[sp++] = r;
+      }
+   }
+   return best;
+}
+
+double Mesh::getIntersection(Ray ray){
+   unsigned int prim;
+   return getPrimIntersection(ray, &prim);
+}
+
+bool Mesh::getLightIntersection(Ray ray, double* fill){
+   const std::vector<BVHNode>& nodes = geom->nodes;
+   if (nodes.empty()) return false;
+   const bool opaque = texture->opacity > 1-1E-6;
+   const double org[3] = {ray.point.x, ray.point.y, ray.point.z};
+   const double inv[3] = {1 / ray.vector.x, 1 / ray.vector.y, 1 / ray.vector.z};
+   int stack[BVH_STACK_SIZE];
+   int sp = 0;
+   double tnear, u, v;
+   const bool hit = bvhHitBox(nodes[0], org, inv, 1., &tnear);
+   STAT_MESH_BOX(hit);
+   if (hit) stack[sp++] = 0;
+   while (sp > 0) {
+      const int ni = stack[--sp];
+      const BVHNode& node = nodes[ni];
+      if (node.count > 0) {
+         for (int f = node.start; f < node.start + node.count; f++) {
+            STAT_INC(faceTests);
+            const double t = intersectFace(this, f, ray, &u, &v);
+            if (!(t > 0 && t < 1.)) continue;
+            if (opaque) return true;
+            unsigned char temp[4];
+            double amb, op, ref;
+            double x, y, width, height;
+            faceCoords(ray.point+ray.vector*t, f, &x, &y, &width, &height);
+            texture->getColor(temp, &amb, &op, &ref, fix(x/textureX-.5), fix(y/textureY-.5));
+            if (op > 1-1E-6) return true;
+            fill[0]*=temp[0] * over255;
+            fill[1]*=temp[1] * over255;
+            fill[2]*=temp[2] * over255;
+         }
+         continue;
+      }
+      const bool hr = bvhHitBox(nodes[node.start], org, inv, 1., &tnear);
+      STAT_MESH_BOX(hr);
+      if (hr) stack[sp++] = node.start;
+      const bool hl = bvhHitBox(nodes[ni + 1], org, inv, 1., &tnear);
+      STAT_MESH_BOX(hl);
+      if (hl) stack[sp++] = ni + 1;
+   }
+   return false;
+}
+
+// The texture frame a Triangle built for face f: right along the first edge,
+// up from the angles Triangle derived (not always perpendicular to the
+// normal), the face's width along right and height along up.
+void Mesh::faceFrame(unsigned int f, Vector* right, Vector* up, Vector* vect, double* width, double* height){
+   const Vector e1(geom->e1x[f], geom->e1y[f], geom->e1z[f]), e2(geom->e2x[f], geom->e2y[f], geom->e2z[f]);
+   *width = e1.mag();
+   *right = e1/(*width);
+   *vect = right->cross(e1-e2).normalize();
+   double xsin = -right->z;
+   if(xsin<-1.)xsin = -1;
+   else if (xsin>1.)xsin=1.;
+   const double xcos = sqrt(1.-xsin*xsin);
+   double zcos = right->x/xcos;
+   double zsin = -right->y/xcos;
+   if(zsin<-1.)zsin = -1;
+   else if (zsin>1.)zsin=1.;
+   if(zcos<-1.)zcos = -1;
+   else if (zcos>1.)zcos=1.;
+   double ycos = vect->z/xcos;
+   if(ycos<-1.)ycos = -1;
+   else if (ycos>1.)ycos=1.;
+   const double ysin = sqrt(1-ycos*ycos);
+   up->x = -xsin*ysin*zcos+ycos*zsin;
+   up->y = ycos*zcos+xsin*ysin*zsin;
+   up->z = -xcos*ysin;
+   *height = solveScalers(*right, *up, *vect, e2).y;
+}
+
+// Position of point on face f in units of the face's width and height, as
+// Triangle mapped textures
+void Mesh::faceCoords(Vector point, unsigned int f, double* x, double* y, double* width, double* height){
+   Vector right(0,0,0), up(0,0,0), vect(0,0,0);
+   faceFrame(f, &right, &up, &vect, width, height);
+   const Vector dist = solveScalers(right, up, vect, point - Vector(geom->v0x[f], geom->v0y[f], geom->v0z[f]));
+   *x = dist.x/(*width);
+   *y = dist.y/(*height);
+}
+
+void Mesh::getPrimColor(unsigned char* toFill, double* am, double* op, double* ref, Autonoma* r, Ray ray, unsigned int depth, unsigned int prim, double footprint){
+   double x, y, width, height;
+   faceCoords(ray.point, prim, &x, &y, &width, &height);
+   if (footprint > 0) {
+      const double w = fabs(width*textureX), h = fabs(height*textureY);
+      footprint /= (w<h) ? w : h;
+   }
+   texture->getFilteredColor(toFill, am, op, ref, fix(x/textureX-.5), fix(y/textureY-.5), footprint);
+}
+
+// Shading needs the face that was hit, see getPrimColor
+void Mesh::getColor(unsigned char* toFill, double* am, double* op, double* ref, Autonoma* r, Ray ray, unsigned int depth, double footprint){
+   printf("Mesh::getColor called without a face\n");
+   exit(1);
+}
+
+Vector Mesh::getPrimNormal(Vector point, unsigned int f){
+   // Same winding as Triangle: (p1-p0) x (p1-p2) = e2 x e1
+   Vector e1(geom->e1x[f], geom->e1y[f], geom->e1z[f]), e2(geom->e2x[f], geom->e2y[f], geom->e2z[f]);
+   if(normalMap==NULL)
+      return e2.cross(e1).normalize();
+   Vector right(0,0,0), up(0,0,0), vect(0,0,0);
+   double width, height;
+   faceFrame(f, &right, &up, &vect, &width, &height);
+   const Vector dist = solveScalers(right, up, vect, point - Vector(geom->v0x[f], geom->v0y[f], geom->v0z[f]));
+   double am, ref, op;
+   unsigned char norm[3];
+   normalMap->getColor(norm, &am, &op, &ref, fix(dist.x/(width*mapX)-.5+mapOffX), fix(dist.y/(height*mapY)-.5+mapOffY));
+   return ((norm[0]-128)*right+(norm[1]-128)*up+norm[2]*vect).normalize();
+}
+
+Vector Mesh::getNormal(Vector point){
+   printf("Mesh::getNormal called without a face\n");
+   exit(1);
+}
+
+void Mesh::move(){
+   return;
+}
+
+unsigned char Mesh::reversible(){
+   return 1;
+}
+
+// Mesh orientation is baked into the vertices
+void Mesh::setAngles(double a, double b, double c){
+   yaw =a; pitch = b; roll = c;
+}
+
+void Mesh::setYaw(double a){
+   yaw =a;
+}
+
+void Mesh::setPitch(double b){
+   pitch = b;
+}
+
+void Mesh::setRoll(double c){
+   roll = c;
+}
+
+bool Mesh::getBounds(Vector& min, Vector& max){
+   min = min_v;
+   max = max_v;
+   return !geom->nodes.empty();
+}
+
+// The copy shares geometry, only placement and texture mapping are its own
+Shape* Mesh::clone(){
+   return new Mesh(*this);
+}
+
+bool Mesh::rotationMovesSurface(){
+   return false;
+}
+
+ShapeKind Mesh::kind(){
+   return SHAPE_MESH;
+}
@@ -0,0 +1,53 @@
+#ifndef __MESH_H__
+#define __MESH_H__
+#include <vector>
+#include "shape.h"
+#include "bvh.h"
+
+// Per face (leaf order of the BVH): first vertex and the edges to the other
+// two, and the BVH over the faces. Fixed once built, so every copy of a mesh
+// (Mesh::clone) shares one.
+struct MeshGeometry {
+   std::vector<double> v0x, v0y, v0z, e1x, e1y, e1z, e2x, e2y, e2z;
+   std::vector<BVHNode> nodes;
+};
+
+// OPTIM: A whole triangle mesh as one shape. Faces live in flat arrays in the
+// leaf order of the mesh's own BVH instead of one Triangle object each, and
+// share a single texture / normalMap. Face ids passed around as "prim" index
+// these arrays.
+class Mesh : public Shape{
+public:
+   // Raw data as loaded, 3 floats per point and 3 indices per face. Not
+   // owned by the mesh.
+   unsigned int numPoints, numFaces;
+   float* points;
+   unsigned int* indices;
+   Vector offset;
+   MeshGeometry* geom;
+   Vector min_v, max_v;
+
+   Mesh(float* points, unsigned int numPoints, unsigned int* indices, unsigned int numFaces, const Vector& offset, Texture* t);
+   double getIntersection(Ray ray);
+   double getPrimIntersection(Ray ray, unsigned int* prim);
+   bool getLightIntersection(Ray ray, double* fill);
+   void move();
+   void getColor(unsigned char* toFill, double* am, double* op, double* ref, Autonoma* r, Ray ray, unsigned int depth, double footprint);
+   void getPrimColor(unsigned char* toFill, double* am, double* op, double* ref, Autonoma* r, Ray ray, unsigned int depth, unsigned int prim, double footprint);
+   Vector getNormal(Vector point);
+   Vector getPrimNormal(Vector point, unsigned int prim);
+   unsigned char reversible();
+   void setAngles(double a, double b, double c);
+   void setYaw(double a);
+   void setPitch(double b);
+   void setRoll(double c);
+   bool getBounds(Vector& min, Vector& max);
+   ShapeKind kind();
+   Shape* clone();
+   bool rotationMovesSurface();
+private:
+   void faceFrame(unsigned int prim, Vector* right, Vector* up, Vector* vect, double* width, double* height);
+   void faceCoords(Vector point, unsigned int prim, double* x, double* y, double* width, double* height);
+};
+
+#endif
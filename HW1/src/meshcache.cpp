@@ -0,0 +1,65 @@
+#include "meshcache.h"
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static bool statSource(const char* file, MeshCacheSource* source) {
+   struct stat st;
+   if (stat(file, &st) != 0) return false;
+   source->size = st.st_size;
+   source->mtime = (unsigned long long)st.st_mtim.tv_sec * 1000000000ull + st.st_mtim.tv_nsec;
+   source->inode = st.st_ino;
+   return true;
+}
+
+bool readMeshCache(const char* cacheFile, const char* pointFile, const char* polyFile,
+                   unsigned int numPoints, unsigned int numFaces, float** points, unsigned int** indices,
+                   MeshCacheHeader* expected) {
+   // Stamped before the text is parsed, so an edit during the parse makes
+   // the written cache stale rather than wrong
+   memset(expected, 0, sizeof(*expected));
+   memcpy(expected->magic, MESH_CACHE_MAGIC, sizeof(expected->magic));
+   expected->version = MESH_CACHE_VERSION;
+   expected->numPoints = numPoints;
+   expected->numFaces = numFaces;
+   if (!statSource(pointFile, &expected->pointSource) || !statSource(polyFile, &expected->polySource)) return false;
+
+   struct stat cacheStat;
+   if (stat(cacheFile, &cacheStat) != 0) return false;
+   const size_t size = sizeof(MeshCacheHeader) + 3 * sizeof(float) * (size_t)numPoints
+                     + 3 * sizeof(unsigned int) * (size_t)numFaces;
+   if ((size_t)cacheStat.st_size != size) return false;
+
+   int fd = open(cacheFile, O_RDONLY);
+   if (fd < 0) return false;
+   void* data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+   close(fd);
+   if (data == MAP_FAILED) return false;
+
+   if (memcmp(data, expected, sizeof(MeshCacheHeader)) != 0) {
+      munmap(data, size);
+      return false;
+   }
+   // The mapping lives as long as the scene, i.e. the whole run
+   *points = (float*)((char*)data + sizeof(MeshCacheHeader));
+   *indices = (unsigned int*)(*points + 3 * (size_t)numPoints);
+   return true;
+}
+
+void writeMeshCache(const char* cacheFile, const MeshCacheHeader& header, const float* points,
+                    const unsigned int* indices) {
+   // Write to a temporary and rename so a concurrent reader never sees a
+   // partial file
+   char tmpFile[1100];
+   snprintf(tmpFile, sizeof(tmpFile), "%s.tmp.%d", cacheFile, (int)getpid());
+   FILE* f = fopen(tmpFile, "wb");
+   if (!f) return;
+   bool ok = fwrite(&header, sizeof(header), 1, f) == 1
+          && fwrite(points, 3 * sizeof(float), header.numPoints, f) == header.numPoints
+          && fwrite(indices, 3 * sizeof(unsigned int), header.numFaces, f) == header.numFaces;
+   ok = (fclose(f) == 0) && ok;
+   if (!ok || rename(tmpFile, cacheFile) != 0) remove(tmpFile);
+}
@@ -0,0 +1,39 @@
+#ifndef __MESHCACHE_H__
+#define __MESHCACHE_H__
+
+// OPTIM: Binary cache of a mesh's text point / face files. Layout (native
+// endian): MeshCacheHeader, numPoints packed float3, numFaces packed uint3.
+#define MESH_CACHE_MAGIC "RAYMESH"
+#define MESH_CACHE_VERSION 2
+
+// Identifies the exact text file a cache was built from
+struct MeshCacheSource {
+   unsigned long long size;
+   unsigned long long mtime; // nanoseconds
+   unsigned long long inode;
+};
+
+struct MeshCacheHeader {
+   char magic[8];
+   unsigned int version;
+   unsigned int numPoints;
+   unsigned int numFaces;
+   unsigned int reserved;
+   // The cache is named after the face file only, so scenes pairing it with
+   // different point files tell their caches apart here
+   MeshCacheSource pointSource, polySource;
+};
+
+// mmap the cache and point straight into it. Fails (returns false) when the
+// cache is missing, from another version, does not match the expected counts,
+// or was built from other text files than the two given (size, mtime, inode).
+// Either way header is filled in for writeMeshCache.
+bool readMeshCache(const char* cacheFile, const char* pointFile, const char* polyFile,
+                   unsigned int numPoints, unsigned int numFaces, float** points, unsigned int** indices,
+                   MeshCacheHeader* header);
+
+// Best effort, a failure only means the next run parses the text again
+void writeMeshCache(const char* cacheFile, const MeshCacheHeader& header, const float* points,
+                    const unsigned int* indices);
+
+#endif
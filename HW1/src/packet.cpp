@@ -0,0 +1,267 @@
+#include "packet.h"
+#include "bvh.h"
+#include "shapedispatch.h"
+
+// The kernels below mirror the scalar getIntersection code of each shape
+// lane by lane, with branches turned into selects so they vectorize.
+
+namespace {
+
+__attribute__((always_inline))
+inline bool boxMiss(const Vector& lo, const Vector& hi, double ox, double oy, double oz,
+                    double dx, double dy, double dz) {
+   const double overX = 1/dx, overY = 1/dy, overZ = 1/dz;
+   double a = (lo.x - ox) * overX, b = (hi.x - ox) * overX;
+   double tmin = (a > b) ? b : a, tmax = (a > b) ? a : b;
+   a = (lo.y - oy) * overY; b = (hi.y - oy) * overY;
+   const double tymin = (a > b) ? b : a, tymax = (a > b) ? a : b;
+   bool miss = (tmin > tymax) || (tymin > tmax);
+   tmin = (tymin > tmin) ? tymin : tmin;
+   tmax = (tymax < tmax) ? tymax : tmax;
+   a = (lo.z - oz) * overZ; b = (hi.z - oz) * overZ;
+   const double tzmin = (a > b) ? b : a, tzmax = (a > b) ? a : b;
+   return miss || (tmin > tzmax) || (tzmin > tmax);
+}
+
+void sphereLanes(Sphere* s, const RayPacket& p, double* t) {
+   const double cx = s->center.x, cy = s->center.y, cz = s->center.z;
+   const double r2 = s->radius * s->radius;
+   #pragma omp simd
+   for (int k = 0; k < PACKET_WIDTH; k++) {
+      const bool miss = boxMiss(s->min_v, s->max_v, p.ox[k], p.oy[k], p.oz[k], p.dx[k], p.dy[k], p.dz[k]);
+      const double px = p.ox[k] - cx, py = p.oy[k] - cy, pz = p.oz[k] - cz;
+      const double A = p.dx[k] * p.dx[k] + p.dy[k] * p.dy[k] + p.dz[k] * p.dz[k];
+      const double B = 2 * (p.dx[k] * px + p.dy[k] * py + p.dz[k] * pz);
+      const double C = (px * px + py * py + pz * pz) - r2;
+      const double disc = B * B - 4 * A * C;
+      const double desc = sqrt(disc < 0 ? 0 : disc);
+      const double root1 = (-B - desc) / (2 * A);
+      const double root2 = (-B + desc) / (2 * A);
+      const double r = (root1 > 0) ? root1 : ((root2 > 0) ? root2 : inf);
+      t[k] = (miss || disc < 0) ? inf : r;
+   }
+}
+
+__attribute__((always_inline))
+inline double planeTime(const Plane* s, double ox, double oy, double oz, double dx, double dy, double dz) {
+   const double tt = dx * s->vect.x + dy * s->vect.y + dz * s->vect.z;
+   const double norm = s->vect.x * ox + s->vect.y * oy + s->vect.z * oz + s->d;
+   const double r = -norm / tt;
+   return (tt == 0 || !(r > 0)) ? inf : r;
+}
+
+void planeLanes(Plane* s, const RayPacket& p, double* t) {
+   #pragma omp simd
+   for (int k = 0; k < PACKET_WIDTH; k++)
+      t[k] = planeTime(s, p.ox[k], p.oy[k], p.oz[k], p.dx[k], p.dy[k], p.dz[k]);
+}
+
+void triangleLanes(Triangle* s, const RayPacket& p, double* t) {
+   // solveScalers(right, up, vect, C) with the determinant hoisted out
+   const Vector v1 = s->right, v2 = s->up, v3 = s->vect;
+   const double denom = v1.z*v2.y*v3.x - v1.y*v2.z*v3.x - v1.z*v2.x*v3.y + v1.x*v2.z*v3.y + v1.y*v2.x*v3.z - v1.x*v2.y*v3.z;
+   const double rcp = 1.0 / denom;
+   const double tX = s->textureX, tY = s->textureY, thirdX = s->thirdX;
+   #pragma omp simd
+   for (int k = 0; k < PACKET_WIDTH; k++) {
+      const bool miss = boxMiss(s->min_v, s->max_v, p.ox[k], p.oy[k], p.oz[k], p.dx[k], p.dy[k], p.dz[k]);
+      const double time = planeTime(s, p.ox[k], p.oy[k], p.oz[k], p.dx[k], p.dy[k], p.dz[k]);
+      const double cx = (p.ox[k] + p.dx[k] * time) - s->center.x;
+      const double cy = (p.oy[k] + p.dy[k] * time) - s->center.y;
+      const double cz = (p.oz[k] + p.dz[k] * time) - s->center.z;
+      const double a = cz*v2.y*v3.x - cy*v2.z*v3.x - cz*v2.x*v3.y + cx*v2.z*v3.y + cy*v2.x*v3.z - cx*v2.y*v3.z;
+      const double b = -cz*v1.y*v3.x + cy*v1.z*v3.x + cz*v1.x*v3.y - cx*v1.z*v3.y - cy*v1.x*v3.z + cx*v1.y*v3.z;
+      const double distX = a * rcp, distY = b * rcp;
+      const bool tmp = (thirdX - distX) * tY + (thirdX - tX) * (distY - tY) < 0.0;
+      const bool out = (tmp != (tX * distY < 0.0)) || (tmp != (distX * tY - thirdX * distY < 0.0));
+      t[k] = (miss || time == inf || out) ? inf : time;
+   }
+}
+
+__attribute__((always_inline))
+inline void shapeLanes(Shape* s, unsigned char kind, const RayPacket& p, double* t) {
+   switch (kind) {
+   case SHAPE_SPHERE: STAT_ADD(shapeTests[kind], p.n); sphereLanes((Sphere*)s, p, t); break;
+   case SHAPE_PLANE: STAT_ADD(shapeTests[kind], p.n); planeLanes((Plane*)s, p, t); break;
+   case SHAPE_TRIANGLE: STAT_ADD(shapeTests[kind], p.n); triangleLanes((Triangle*)s, p, t); break;
+   default:
+      unsigned int prim;
+      for (int k = 0; k < p.n; k++)
+         t[k] = kindIntersection(s, kind, Ray(Vector(p.ox[k], p.oy[k], p.oz[k]), Vector(p.dx[k], p.dy[k], p.dz[k])), &prim);
+      for (int k = p.n; k < PACKET_WIDTH; k++) t[k] = inf;
+   }
+}
+
+__attribute__((always_inline))
+inline void keepClosest(const double* t, Shape* s, int idx, double* best, int* bestIdx, Shape** bestShape, unsigned int* bestPrim) {
+   for (int k = 0; k < PACKET_WIDTH; k++) {
+      if (t[k] > 0 && t[k] != inf && (t[k] < best[k] || (t[k] == best[k] && idx < bestIdx[k]))) {
+         best[k] = t[k];
+         bestIdx[k] = idx;
+         bestShape[k] = s;
+         bestPrim[k] = 0;
+      }
+   }
+}
+
+// Conservative per-lane slab test, true if any lane enters the box before its
+// current closest hit
+__attribute__((always_inline))
+inline bool anyHitBox(const BVHNode& n, const RayPacket& p, const double* inv, const double* best) {
+   bool any = false;
+   for (int k = 0; k < PACKET_WIDTH; k++) {
+      const double org[3] = {p.ox[k], p.oy[k], p.oz[k]};
+      double tnear;
+      any |= bvhHitBox(n, org, &inv[3 * k], best[k], &tnear);
+   }
+   return any;
+}
+
+// Walk the mesh's own BVH with the whole packet, Moller-Trumbore on each face
+// of a visited leaf for all lanes at once
+void meshLanes(Mesh* m, int idx, const RayPacket& p, const double* inv, double* best, int* bestIdx, Shape** bestShape, unsigned int* bestPrim) {
+   if (m->geom->nodes.empty()) return;
+   const BVHNode* nodes = &m->geom->nodes[0];
+   int stack[BVH_STACK_SIZE];
+   int sp = 0;
+   // Box counters count a packet's test as one
+   const bool hit = anyHitBox(nodes[0], p, inv, best);
+   STAT_MESH_BOX(hit);
+   if (hit) stack[sp++] = 0;
+   while (sp > 0) {
+      const int ni = stack[--sp];
+      const BVHNode& node = nodes[ni];
+      if (node.count > 0) {
+         STAT_ADD(faceTests, node.count * p.n);
+         for (int f = node.start; f < node.start + node.count; f++) {
+            const double e1x = m->geom->e1x[f], e1y = m->geom->e1y[f], e1z = m->geom->e1z[f];
+            const double e2x = m->geom->e2x[f], e2y = m->geom->e2y[f], e2z = m->geom->e2z[f];
+            const double v0x = m->geom->v0x[f], v0y = m->geom->v0y[f], v0z = m->geom->v0z[f];
+            double t[PACKET_WIDTH];
+            #pragma omp simd
+            for (int k = 0; k < PACKET_WIDTH; k++) {
+               const double px = p.dy[k] * e2z - p.dz[k] * e2y;
+               const double py = p.dz[k] * e2x - p.dx[k] * e2z;
+               const double pz = p.dx[k] * e2y - p.dy[k] * e2x;
+               const double det = e1x * px + e1y * py + e1z * pz;
+               const double rdet = 1 / det;
+               const double tx = p.ox[k] - v0x, ty = p.oy[k] - v0y, tz = p.oz[k] - v0z;
+               const double u = (tx * px + ty * py + tz * pz) * rdet;
+               const double qx = ty * e1z - tz * e1y;
+               const double qy = tz * e1x - tx * e1z;
+               const double qz = tx * e1y - ty * e1x;
+               const double v = (p.dx[k] * qx + p.dy[k] * qy + p.dz[k] * qz) * rdet;
+               const double time = (e2x * qx + e2y * qy + e2z * qz) * rdet;
+               const bool hit = det != 0 && u >= 0 && u <= 1 && v >= 0 && u + v <= 1;
+               t[k] = hit ? time : inf;
+            }
+            for (int k = 0; k < PACKET_WIDTH; k++) {
+               if (t[k] > 0 && t[k] != inf && (t[k] < best[k] || (t[k] == best[k] && idx < bestIdx[k]))) {
+                  best[k] = t[k];
+                  bestIdx[k] = idx;
+                  bestShape[k] = m;
+                  bestPrim[k] = f;
+               }
+            }
+         }
+         continue;
+      }
+      const bool hr = anyHitBox(nodes[node.start], p, inv, best);
+      STAT_MESH_BOX(hr);
+      if (hr) stack[sp++] = node.start;
+      const bool hl = anyHitBox(nodes[ni + 1], p, inv, best);
+      STAT_MESH_BOX(hl);
+      if (hl) stack[sp++] = ni + 1;
+   }
+}
+
+// Move the packet into the shared mesh's space as Instance::toMesh does and
+// walk the mesh's BVH with it. The transform is rigid, so hit times carry
+// over and the faces found are the instance's.
+void instanceLanes(Instance* s, int idx, const RayPacket& p, double* best, int* bestIdx, Shape** bestShape, unsigned int* bestPrim) {
+   STAT_ADD(shapeTests[SHAPE_INSTANCE], p.n);
+   const Vector c = s->center, o = s->offset, r = s->right, u = s->up, v = s->vect;
+   RayPacket q;
+   q.n = p.n;
+   double inv[3 * PACKET_WIDTH];
+   for (int k = 0; k < PACKET_WIDTH; k++) {
+      const double px = p.ox[k] - c.x, py = p.oy[k] - c.y, pz = p.oz[k] - c.z;
+      q.ox[k] = (px * r.x + py * r.y + pz * r.z) + o.x;
+      q.oy[k] = (px * u.x + py * u.y + pz * u.z) + o.y;
+      q.oz[k] = (px * v.x + py * v.y + pz * v.z) + o.z;
+      q.dx[k] = p.dx[k] * r.x + p.dy[k] * r.y + p.dz[k] * r.z;
+      q.dy[k] = p.dx[k] * u.x + p.dy[k] * u.y + p.dz[k] * u.z;
+      q.dz[k] = p.dx[k] * v.x + p.dy[k] * v.y + p.dz[k] * v.z;
+      inv[3 * k] = 1 / q.dx[k];
+      inv[3 * k + 1] = 1 / q.dy[k];
+      inv[3 * k + 2] = 1 / q.dz[k];
+   }
+   meshLanes(s, idx, q, inv, best, bestIdx, bestShape, bestPrim);
+}
+
+}
+
+void intersectPacket(BVH* bvh, const RayPacket& p, double* time, Shape** shape, unsigned int* prim) {
+   double best[PACKET_WIDTH];
+   int bestIdx[PACKET_WIDTH];
+   double t[PACKET_WIDTH];
+   double inv[3 * PACKET_WIDTH];
+   for (int k = 0; k < PACKET_WIDTH; k++) {
+      best[k] = inf;
+      bestIdx[k] = -1;
+      shape[k] = NULL;
+      prim[k] = 0;
+      inv[3 * k] = 1 / p.dx[k];
+      inv[3 * k + 1] = 1 / p.dy[k];
+      inv[3 * k + 2] = 1 / p.dz[k];
+   }
+
+   for (size_t i = 0; i < bvh->unbounded.size(); i++) {
+      if (bvh->unboundedKind[i] == SHAPE_MESH) {
+         meshLanes((Mesh*)bvh->unbounded[i], bvh->unboundedIndex[i], p, inv, best, bestIdx, shape, prim);
+         continue;
+      }
+      if (bvh->unboundedKind[i] == SHAPE_INSTANCE) {
+         instanceLanes((Instance*)bvh->unbounded[i], bvh->unboundedIndex[i], p, best, bestIdx, shape, prim);
+         continue;
+      }
+      shapeLanes(bvh->unbounded[i], bvh->unboundedKind[i], p, t);
+      keepClosest(t, bvh->unbounded[i], bvh->unboundedIndex[i], best, bestIdx, shape, prim);
+   }
+
+   if (!bvh->nodes.empty()) {
+      const BVHNode* nodes = &bvh->nodes[0];
+      int stack[BVH_STACK_SIZE];
+      int sp = 0;
+      const bool hit = anyHitBox(nodes[0], p, inv, best);
+      STAT_SCENE_BOX(bvh, nodes[0], hit);
+      if (hit) stack[sp++] = 0;
+      while (sp > 0) {
+         const int ni = stack[--sp];
+         const BVHNode& node = nodes[ni];
+         if (node.count > 0) {
+            for (int i = node.start; i < node.start + node.count; i++) {
+               if (bvh->primKind[i] == SHAPE_MESH) {
+                  meshLanes((Mesh*)bvh->prims[i], bvh->primIndex[i], p, inv, best, bestIdx, shape, prim);
+                  continue;
+               }
+               if (bvh->primKind[i] == SHAPE_INSTANCE) {
+                  instanceLanes((Instance*)bvh->prims[i], bvh->primIndex[i], p, best, bestIdx, shape, prim);
+                  continue;
+               }
+               shapeLanes(bvh->prims[i], bvh->primKind[i], p, t);
+               keepClosest(t, bvh->prims[i], bvh->primIndex[i], best, bestIdx, shape, prim);
+            }
+            continue;
+         }
+         const bool hr = anyHitBox(nodes[node.start], p, inv, best);
+         STAT_SCENE_BOX(bvh, nodes[node.start], hr);
+         if (hr) stack[sp++] = node.start;
+         const bool hl = anyHitBox(nodes[ni + 1], p, inv, best);
+         STAT_SCENE_BOX(bvh, nodes[ni + 1], hl);
+         if (hl) stack[sp++] = ni + 1;
+      }
+   }
+
+   for (int k = 0; k < PACKET_WIDTH; k++) time[k] = best[k];
+}
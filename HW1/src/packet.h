@@ -0,0 +1,30 @@
+#ifndef __PACKET_H__
+#define __PACKET_H__
+#include "vector.h"
+
+class Shape;
+class BVH;
+
+// OPTIM: number of rays traced together, 8 doubles fill one AVX-512 register
+// or two AVX2 registers
+#ifndef PACKET_WIDTH
+#define PACKET_WIDTH 8
+#endif
+// Packets cover a PACKET_TILE_W x PACKET_TILE_H block of pixels
+#define PACKET_TILE_W 4
+#define PACKET_TILE_H (PACKET_WIDTH / PACKET_TILE_W)
+
+// Structure of arrays bundle of rays. Lanes at or past n are padding and must
+// hold a valid copy of some other lane.
+struct RayPacket {
+   double ox[PACKET_WIDTH], oy[PACKET_WIDTH], oz[PACKET_WIDTH];
+   double dx[PACKET_WIDTH], dy[PACKET_WIDTH], dz[PACKET_WIDTH];
+   int n;
+};
+
+// Closest hit for every lane, same result as BVH::intersect on each ray.
+// Spheres, planes, triangles, meshes and mesh instances use SoA kernels,
+// other shapes go scalar (and only ever hit prim 0).
+void intersectPacket(BVH* bvh, const RayPacket& p, double* time, Shape** shape, unsigned int* prim);
+
+#endif
@@ -104,13 +104,22 @@ bool Plane::getLightIntersection(Ray ray, double* fill){
 void Plane::move(){
    d = -vect.dot(center);
 }
-void Plane::getColor(unsigned char* toFill,double* am, double* op, double* ref, Autonoma* r, Ray ray, unsigned int depth){
+void Plane::getColor(unsigned char* toFill,double* am, double* op, double* ref, Autonoma* r, Ray ray, unsigned int depth, double footprint){
    Vector dist = solveScalers(right, up, vect, ray.point-center);
-   texture->getColor(toFill, am, op, ref, fix(dist.x/textureX-.5), fix(dist.y/textureY-.5));
+   if (footprint > 0) footprint /= (fabs(textureX)<fabs(textureY)) ? fabs(textureX) : fabs(textureY);
+   texture->getFilteredColor(toFill, am, op, ref, fix(dist.x/textureX-.5), fix(dist.y/textureY-.5), footprint);
 }
 unsigned char Plane::reversible(){ 
    return 1; }
 
+ShapeKind Plane::kind(){
+   return SHAPE_PLANE;
+}
+
+Shape* Plane::clone(){
+   return new Plane(*this);
+}
+
 Vector Plane::getNormal(Vector point){
    if(normalMap==NULL)
       return vect;
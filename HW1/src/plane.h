@@ -11,13 +11,15 @@ public:
   double getIntersection(Ray ray);
   bool getLightIntersection(Ray ray, double* toFill);
   void move();
-  void getColor(unsigned char* toFill, double* am, double* op, double* ref, Autonoma* r, Ray ray, unsigned int depth);
+  void getColor(unsigned char* toFill, double* am, double* op, double* ref, Autonoma* r, Ray ray, unsigned int depth, double footprint);
   Vector getNormal(Vector point);
   unsigned char reversible();
   void setAngles(double yaw, double pitch, double roll);
   void setYaw(double d);
   void setPitch(double d);
   void setRoll(double d);
+  ShapeKind kind();
+  Shape* clone();
 };
 
 #endif
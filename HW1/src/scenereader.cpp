@@ -0,0 +1,143 @@
+#include "scenereader.h"
+#include <charconv>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static inline bool isBlank(char c) {
+   return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
+
+SceneReader::SceneReader(const char* p) : path(p), data(NULL), size(0), line(1), recordLine(0), ended(false) {
+   const int fd = open(path, O_RDONLY);
+   struct stat st;
+   if (fd < 0 || fstat(fd, &st) != 0) {
+      printf("Could not open input file %s\n", path);
+      exit(1);
+   }
+   size = st.st_size;
+   if (size > 0) {
+      void* map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (map == MAP_FAILED) {
+         printf("Could not read input file %s\n", path);
+         exit(1);
+      }
+      madvise(map, size, MADV_SEQUENTIAL);
+      data = (const char*)map;
+   }
+   close(fd);
+   cur = limit = data;
+}
+
+SceneReader::~SceneReader() {
+   if (size > 0) munmap((void*)data, size);
+}
+
+void SceneReader::fail(const char* message) {
+   printf("%s:%d: %s\n", path, recordLine, message);
+   exit(1);
+}
+
+// Skip the rest of the current record, then any empty, blank or comment
+// lines, and bound the fields by the end of the line found
+bool SceneReader::nextRecord() {
+   const char* end = data + size;
+   cur = limit;
+   while (cur < end) {
+      if (*cur == '\n') {
+         cur++;
+         line++;
+         continue;
+      }
+      const char* eol = (const char*)memchr(cur, '\n', end - cur);
+      if (!eol) eol = end;
+      const char* p = cur;
+      while (p < eol && isBlank(*p)) p++;
+      if (p == eol || *cur == '#') {
+         cur = eol;
+         continue;
+      }
+      recordLine = line;
+      limit = eol;
+      return true;
+   }
+   recordLine = line;
+   ended = true;
+   return false;
+}
+
+int SceneReader::fields(const char* fmt, va_list ap, bool crossLines) {
+   const char* end = crossLines ? data + size : limit;
+   int count = 0;
+   for (const char* f = fmt; *f; f++) {
+      if (*f != '%') continue;
+      f++;
+      size_t width = 0;
+      while (*f >= '0' && *f <= '9') width = width * 10 + (*f++ - '0');
+      bool isLong = false;
+      if (*f == 'l') {
+         isLong = true;
+         f++;
+      }
+
+      while (cur < end && (isBlank(*cur) || *cur == '\n')) {
+         if (*cur == '\n') line++;
+         cur++;
+      }
+      if (crossLines) recordLine = line;
+      if (cur >= end) return (crossLines && count == 0) ? EOF : count;
+      const char* tokenEnd = cur;
+      while (tokenEnd < end && !isBlank(*tokenEnd) && *tokenEnd != '\n') tokenEnd++;
+
+      if (*f == 's') {
+         const size_t n = tokenEnd - cur;
+         if (width == 0 || n > width) return count;
+         char* out = va_arg(ap, char*);
+         memcpy(out, cur, n);
+         out[n] = '\0';
+         cur = tokenEnd;
+         count++;
+         continue;
+      }
+      // from_chars takes no leading +, scanf does
+      const char* first = (*cur == '+' && cur + 1 < tokenEnd) ? cur + 1 : cur;
+      std::from_chars_result r;
+      switch (*f) {
+      case 'd': r = std::from_chars(first, tokenEnd, *va_arg(ap, int*)); break;
+      case 'u': r = std::from_chars(first, tokenEnd, *va_arg(ap, unsigned int*)); break;
+      case 'f':
+         if (isLong) r = std::from_chars(first, tokenEnd, *va_arg(ap, double*));
+         else r = std::from_chars(first, tokenEnd, *va_arg(ap, float*));
+         break;
+      default:
+         printf("Unsupported conversion %%%c in SceneReader format \"%s\"\n", *f, fmt);
+         exit(1);
+      }
+      if (r.ec != std::errc()) return count;
+      // Like scanf, whatever follows the number is left for the next field
+      cur = r.ptr;
+      count++;
+   }
+   return count;
+}
+
+int SceneReader::scan(const char* fmt, ...) {
+   if (!nextRecord()) return EOF;
+   va_list ap;
+   va_start(ap, fmt);
+   const int count = fields(fmt, ap, false);
+   va_end(ap);
+   return count;
+}
+
+int SceneReader::scanWords(const char* fmt, ...) {
+   va_list ap;
+   va_start(ap, fmt);
+   const int count = fields(fmt, ap, true);
+   va_end(ap);
+   return count;
+}
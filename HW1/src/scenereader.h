@@ -0,0 +1,45 @@
+#ifndef __SCENEREADER_H__
+#define __SCENEREADER_H__
+#include <stddef.h>
+#include <stdarg.h>
+
+// OPTIM: Text input (.ray, .animate and mesh data files) parsed in one pass
+// over an mmap'd buffer with from_chars, instead of a getline and sscanf per
+// record.
+//
+// The scene grammar is line based: scan() reads the fields of the next line
+// that is not empty, blank or a comment (# in the first column), and
+// ignores whatever follows them on that line. scanWords() reads fields
+// across line ends like fscanf, for the mesh data files.
+//
+// Conversions: %d, %u, %f, %lf, and %Ns for a word of at most N characters
+// (N is required). As with scanf a number ends where it stops parsing, so
+// "1.5" read with %d gives 1 and leaves ".5" to the next field.
+class SceneReader {
+public:
+   // Exits with a message if path cannot be read
+   SceneReader(const char* path);
+   ~SceneReader();
+   // Like sscanf, the number of fields converted before the first missing or
+   // malformed one, or EOF if the file has no records left
+   int scan(const char* fmt, ...) __attribute__((format(scanf, 2, 3)));
+   int scanWords(const char* fmt, ...) __attribute__((format(scanf, 2, 3)));
+   // True once scan() returned EOF
+   bool eof() const { return ended; }
+   // Prints "<path>:<line>: <message>" for the last line scanned and exits
+   [[noreturn]] void fail(const char* message);
+private:
+   const char* path;
+   const char* data;
+   size_t size;
+   const char* cur;
+   // End of the fields scan() may read, the end of the line or of the file
+   const char* limit;
+   // Line of cur, and of the record scan() last started
+   int line, recordLine;
+   bool ended;
+   bool nextRecord();
+   int fields(const char* fmt, va_list ap, bool crossLines);
+};
+
+#endif
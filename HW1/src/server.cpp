@@ -0,0 +1,112 @@
+#include "server.h"
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+void serveError(FILE* out, const char* message) {
+   fprintf(out, "ERR %s\n", message);
+   fflush(out);
+}
+
+void serveImage(FILE* out, const char* head, const unsigned char* data, size_t size) {
+   const size_t headSize = head ? strlen(head) : 0;
+   fprintf(out, "OK %zu\n", headSize + size);
+   if (head) fwrite(head, 1, headSize, out);
+   fwrite(data, 1, size, out);
+   fflush(out);
+}
+
+// Answers every request read from in until it closes
+static void serveStream(FILE* in, FILE* out, ServeFn render, void* arg) {
+   char* line = NULL;
+   size_t len = 0;
+   while (getline(&line, &len, in) != -1) {
+      char kind[16];
+      int fields;
+      if (sscanf(line, "%15s%n", kind, &fields) != 1) continue;
+      RenderRequest request;
+      if (strcmp(kind, "camera") == 0) {
+         request.kind = REQUEST_CAMERA;
+         if (sscanf(line + fields, "%lf %lf %lf %lf %lf %lf", &request.x, &request.y, &request.z, &request.yaw, &request.pitch, &request.roll) != 6) {
+            serveError(out, "Could not read camera <x> <y> <z> <yaw> <pitch> <roll>");
+            continue;
+         }
+      } else if (strcmp(kind, "frame") == 0) {
+         request.kind = REQUEST_FRAME;
+         if (sscanf(line + fields, "%d", &request.frame) != 1) {
+            serveError(out, "Could not read frame <n>");
+            continue;
+         }
+      } else {
+         serveError(out, "Unknown request, expected one of camera, frame");
+         continue;
+      }
+      render(request, out, arg);
+      // Log lines of a long running server should not wait for exit
+      fflush(stdout);
+   }
+   free(line);
+}
+
+// Responses for "-", or the listening socket
+static FILE* stdioOut = NULL;
+static int listener = -1;
+
+void serveOpen(const char* path) {
+   // A client hanging up surfaces as a failed write, not SIGPIPE
+   signal(SIGPIPE, SIG_IGN);
+   if (strcmp(path, "-") == 0) {
+      // Keep stdout's descriptor for the responses and point fd 1 (printf)
+      // at stderr
+      fflush(stdout);
+      stdioOut = fdopen(dup(1), "wb");
+      if (!stdioOut || dup2(2, 1) < 0) {
+         printf("Could not set up stdout for serving\n");
+         exit(1);
+      }
+      return;
+   }
+
+   struct sockaddr_un addr;
+   memset(&addr, 0, sizeof(addr));
+   addr.sun_family = AF_UNIX;
+   if (strlen(path) >= sizeof(addr.sun_path)) {
+      printf("Socket path %s is too long\n", path);
+      exit(1);
+   }
+   strcpy(addr.sun_path, path);
+   listener = socket(AF_UNIX, SOCK_STREAM, 0);
+   unlink(path);
+   if (listener < 0 || bind(listener, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(listener, 8) != 0) {
+      printf("Could not listen on socket %s\n", path);
+      exit(1);
+   }
+}
+
+void serve(ServeFn render, void* arg) {
+   if (stdioOut) {
+      serveStream(stdin, stdioOut, render, arg);
+      fclose(stdioOut);
+      return;
+   }
+   printf("Serving\n");
+   fflush(stdout);
+   while (true) {
+      const int conn = accept(listener, NULL, NULL);
+      if (conn < 0) continue;
+      FILE* in = fdopen(conn, "rb");
+      if (!in) {
+         close(conn);
+         continue;
+      }
+      FILE* out = fdopen(dup(conn), "wb");
+      if (out) {
+         serveStream(in, out, render, arg);
+         fclose(out);
+      }
+      fclose(in);
+   }
+}
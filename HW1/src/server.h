@@ -0,0 +1,41 @@
+#ifndef __SERVER_H__
+#define __SERVER_H__
+#include <stdio.h>
+
+// OPTIM: Render server (--serve). The scene is loaded and its BVH, caches and
+// framebuffer set up once, then any number of renders are requested one per
+// line:
+//
+//    camera <x> <y> <z> <yaw> <pitch> <roll>
+//    frame <n>
+//
+// camera renders the scene as it stands from that camera, frame applies
+// frame n of the animation first. Each request is answered in order with
+// "OK <bytes>\n" followed by the encoded image, or with "ERR <message>\n".
+enum RequestKind { REQUEST_CAMERA, REQUEST_FRAME };
+
+struct RenderRequest {
+   RequestKind kind;
+   int frame;
+   double x, y, z, yaw, pitch, roll;
+};
+
+// Renders request and writes its whole response to out
+typedef void (*ServeFn)(const RenderRequest& request, FILE* out, void* arg);
+
+// With path "-", requests come from stdin and responses go to stdout, and
+// from then on anything printed is sent to stderr instead. Otherwise starts
+// listening on the UNIX socket path, replacing any file there. Called before
+// the scene loads, so its log lines stay out of the responses and a bad
+// socket path fails early.
+void serveOpen(const char* path);
+// Answers requests until stdin closes, or on a socket serves its connections
+// one after the other without returning
+void serve(ServeFn render, void* arg);
+
+void serveError(FILE* out, const char* message);
+// "OK <bytes>\n" and the image, made of the text head (NULL for none) then
+// size bytes of data
+void serveImage(FILE* out, const char* head, const unsigned char* data, size_t size);
+
+#endif
@@ -0,0 +1,103 @@
+#include "shadowcache.h"
+#include "shape.h"
+#include <math.h>
+#include <string.h>
+
+// Entries per cache, a power of two (8 MiB)
+constexpr int SHADOW_CACHE_BITS = 20;
+// Slots tried before giving up on a lookup or an insert
+constexpr int SHADOW_CACHE_PROBES = 8;
+constexpr int SHAPE_STATE = 12;
+constexpr int LIGHT_STATE = 6;
+
+ShadowCache::ShadowCache(Autonoma* scene, double cellSize) :
+    rcpCell(1. / cellSize), mask((1ull << SHADOW_CACHE_BITS) - 1), first(true),
+    shapeState(SHAPE_STATE * scene->shapes.size()), lightState(LIGHT_STATE * scene->lights.size()) {
+   slots = new std::atomic<unsigned long long>[mask + 1];
+   clear();
+}
+
+ShadowCache::~ShadowCache() {
+   delete[] slots;
+}
+
+void ShadowCache::clear() {
+   for (unsigned long long i = 0; i <= mask; i++) slots[i].store(0, std::memory_order_relaxed);
+}
+
+void ShadowCache::beginFrame(Autonoma* scene) {
+   bool changed = false;
+   for (size_t i = 0; i < scene->shapes.size(); i++) {
+      Shape* s = scene->shapes[i];
+      double* o = &shapeState[SHAPE_STATE * i];
+      const double now[SHAPE_STATE] = {s->center.x, s->center.y, s->center.z, s->yaw, s->pitch, s->roll,
+                                       s->textureX, s->textureY, s->mapX, s->mapY, s->mapOffX, s->mapOffY};
+      if (!first && memcmp(o, now, sizeof(now)) != 0) {
+         const bool moved = o[0] != now[0] || o[1] != now[1] || o[2] != now[2] ||
+                            ((o[3] != now[3] || o[4] != now[4] || o[5] != now[5]) && s->rotationMovesSurface());
+         // Opaque shapes block light without looking at their texture, so
+         // turning one in place or moving its texture does not matter
+         changed |= moved || !(s->texture->opacity > 1-1E-6);
+      }
+      memcpy(o, now, sizeof(now));
+   }
+   for (size_t i = 0; i < scene->lights.size(); i++) {
+      Light* l = scene->lights[i];
+      double* o = &lightState[LIGHT_STATE * i];
+      const double now[LIGHT_STATE] = {l->center.x, l->center.y, l->center.z,
+                                       (double)l->color[0], (double)l->color[1], (double)l->color[2]};
+      if (!first && memcmp(o, now, sizeof(now)) != 0) changed = true;
+      memcpy(o, now, sizeof(now));
+   }
+   if (changed) clear();
+   first = false;
+}
+
+unsigned long long ShadowCache::hash(const Shape* shape, int light, const Vector& point) const {
+   const long long cx = (long long)floor(point.x * rcpCell);
+   const long long cy = (long long)floor(point.y * rcpCell);
+   const long long cz = (long long)floor(point.z * rcpCell);
+   unsigned long long h = (unsigned long long)(size_t)shape ^ ((unsigned long long)light << 56);
+   const long long parts[3] = {cx, cy, cz};
+   for (long long c : parts) {
+      // splitmix64 finalizer per component
+      h ^= (unsigned long long)c + 0x9e3779b97f4a7c15ull + (h << 6) + (h >> 2);
+      h ^= h >> 30; h *= 0xbf58476d1ce4e5b9ull;
+      h ^= h >> 27; h *= 0x94d049bb133111ebull;
+      h ^= h >> 31;
+   }
+   return h;
+}
+
+bool ShadowCache::lookup(const Shape* shape, int light, const Vector& point, bool* occluded, double* left) const {
+   const unsigned long long h = hash(shape, light, point);
+   const unsigned long long tag = (h >> 32) | 1;
+   for (int i = 0; i < SHADOW_CACHE_PROBES; i++) {
+      const unsigned long long w = slots[(h + i) & mask].load(std::memory_order_relaxed);
+      if (w == 0) return false;
+      if ((w >> 32) != tag) continue;
+      float f;
+      const unsigned int bits = (unsigned int)w;
+      memcpy(&f, &bits, sizeof(f));
+      *occluded = f < 0;
+      *left = f;
+      return true;
+   }
+   return false;
+}
+
+void ShadowCache::store(const Shape* shape, int light, const Vector& point, bool occluded, double left) {
+   const unsigned long long h = hash(shape, light, point);
+   const unsigned long long tag = (h >> 32) | 1;
+   const float f = occluded ? -1.f : (float)left;
+   unsigned int bits;
+   memcpy(&bits, &f, sizeof(bits));
+   const unsigned long long w = (tag << 32) | bits;
+   for (int i = 0; i < SHADOW_CACHE_PROBES; i++) {
+      unsigned long long expected = 0;
+      std::atomic<unsigned long long>& slot = slots[(h + i) & mask];
+      // Another thread may have added the same key in the meantime, keep
+      // whichever landed first
+      if (slot.compare_exchange_strong(expected, w, std::memory_order_relaxed) || (expected >> 32) == tag) return;
+   }
+}
@@ -0,0 +1,40 @@
+#ifndef __SHADOWCACHE_H__
+#define __SHADOWCACHE_H__
+#include <atomic>
+#include <vector>
+#include "light.h"
+
+// OPTIM: Shadow ray results shared between nearby points and across frames.
+// A result is keyed by the shaded shape, the light and the cell of a grid of
+// cellSize world units that the shaded point falls in, so every point of a
+// cell reuses the shadow of the first one traced there (edges get as blocky
+// as the cell size). Entries stay valid until something that can cast or
+// tint a shadow changes, then the whole cache is dropped.
+class ShadowCache {
+public:
+   ShadowCache(Autonoma* scene, double cellSize);
+   ~ShadowCache();
+   // Compare the scene with the previous frame, before rendering a frame
+   void beginFrame(Autonoma* scene);
+   // True if the shadow ray of (shape, light) at point is known. occluded
+   // and the light left (lightColor[0] after any tinting) are filled in.
+   bool lookup(const Shape* shape, int light, const Vector& point, bool* occluded, double* left) const;
+   void store(const Shape* shape, int light, const Vector& point, bool occluded, double left);
+private:
+   double rcpCell;
+   // Open addressing table, one word per entry: hash tag in the high half
+   // and the result as a float in the low half (negative if occluded). 0 is
+   // an empty slot. Entries are only ever added, so one word is all a
+   // reader needs.
+   std::atomic<unsigned long long>* slots;
+   unsigned long long mask;
+   bool first;
+   // Per shape at the previous frame: center, yaw, pitch, roll and the
+   // texture mapping fields. Per light: center and color.
+   std::vector<double> shapeState;
+   std::vector<double> lightState;
+   unsigned long long hash(const Shape* shape, int light, const Vector& point) const;
+   void clear();
+};
+
+#endif
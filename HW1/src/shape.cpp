@@ -1,7 +1,13 @@
 #include "shape.h"
-#include <vector>
+#include "bvh.h"
+#include "skycube.h"
+#include "stats.h"
 
 Shape::Shape(const Vector &c, Texture* t, double ya, double pi, double ro): center(c), texture(t), yaw(ya), pitch(pi), roll(ro){
+   // Subclasses without their own normal map scaling (Sphere) used to read
+   // these uninitialized
+   mapX = mapY = 1.;
+   mapOffX = mapOffY = 0.;
 };
 
 void Shape::setAngles(double a, double b, double c){
@@ -32,80 +38,161 @@ void Shape::setRoll(double c){
    zsin = sin(roll);
 }
 
-typedef struct {
-   double time;
-   Shape* shape;
-} TimeAndShape;
-
-void insertionSort(std::vector<TimeAndShape>& arr) {
-   int n = arr.size();
-   for (int i = 1; i < n; ++i) {
-      TimeAndShape key = arr[i];
-      int j = i - 1;
-      while (j >= 0 && arr[j].time > key.time) {
-         arr[j + 1] = arr[j];
-         j = j - 1;
-      }
-      arr[j + 1] = key;
-   }
+bool Shape::getBounds(Vector& min, Vector& max){
+   return false;
+}
+
+ShapeKind Shape::kind(){
+   return SHAPE_OTHER;
+}
+
+bool Shape::rotationMovesSurface(){
+   return true;
+}
+
+double Shape::getPrimIntersection(Ray ray, unsigned int* prim){
+   *prim = 0;
+   return getIntersection(ray);
+}
+
+void Shape::getPrimColor(unsigned char* toFill, double* am, double* op, double* ref, Autonoma* r, Ray ray, unsigned int depth, unsigned int prim, double footprint){
+   getColor(toFill, am, op, ref, r, ray, depth, footprint);
+}
+
+Vector Shape::getPrimNormal(Vector point, unsigned int prim){
+   return getNormal(point);
 }
 
-void calcColor(unsigned char* toFill, Autonoma* c, Ray ray, unsigned int depth) {
-  std::vector<TimeAndShape> intersections;
-  for (size_t i = 0; i < c->shapes.size(); ++i) {
-    Shape* shape = c->shapes[i];
-    double time = shape->getIntersection(ray);
-    if (time > 0 && time != inf) {
-      TimeAndShape tas;
-      tas.time = time;
-      tas.shape = shape;
-      intersections.push_back(tas);
-    }
-  }
-
-  insertionSort(intersections);
-
-   if (intersections.empty()) {
-      double opacity, reflection, ambient;
-      Vector temp = ray.vector.normalize();
+// One node of the ray tree still being evaluated
+struct RayFrame {
+   RayFrame() : ray(Vector(0, 0, 0), Vector(0, 0, 0)), intersect(0, 0, 0), normal(0, 0, 0) {}
+   Ray ray;
+   Vector intersect, normal;
+   // Path length from the camera to ray.point, then to intersect once shaded
+   double distance;
+   double opacity, reflection;
+   // Share of the final pixel this ray can still change
+   double weight;
+   unsigned int depth;
+   // 0: transmitted ray next, 1: reflected ray next, 2: finished
+   int phase;
+   unsigned char color[4];
+};
+
+// Local shading of the hit of f.ray, children are left to the caller
+static void shadeHit(RayFrame& f, Autonoma* c, Shape* curShape, double curTime, unsigned int prim) {
+   f.phase = 0;
+   STAT_INC(shadedRays);
+   STAT_ADD(depthSum, f.depth);
+#ifdef RAY_STATS
+   if (f.depth > threadStats.maxDepth) threadStats.maxDepth = f.depth;
+#endif
+   if (curShape == NULL) {
+      // A filtered lookup needs the texture's mip chain, so it skips the cube
+      if (c->skyCube && !(c->pixelSpread > 0)) {
+         c->skyCube->getColor(f.color, f.ray.vector);
+         f.opacity = c->skybox->opacity;
+         f.reflection = c->skybox->reflection;
+         f.phase = 2;
+         return;
+      }
+      double ambient;
+      Vector temp = f.ray.vector.normalize();
       const double x = temp.x;
       const double z = temp.z;
       const double me = (temp.y<0)?-temp.y:temp.y;
       const double angle = atan2(z, x);
-      c->skybox->getColor(toFill, &ambient, &opacity, &reflection, fix(angle/M_TWO_PI),fix(me));
+      c->skybox->getFilteredColor(f.color, &ambient, &f.opacity, &f.reflection, fix(angle/M_TWO_PI),fix(me), c->pixelSpread);
+      f.phase = 2;
       return;
    }
 
-   double curTime = intersections[0].time;
-   Shape* curShape = intersections[0].shape;
+   f.intersect = curTime*f.ray.vector+f.ray.point;
+   // OPTIM: ray cone footprint for texture filtering, a pixel's cone keeps
+   // widening along reflections and transmissions
+   double footprint = 0;
+   if (c->pixelSpread > 0) {
+      f.distance += curTime*f.ray.vector.mag();
+      footprint = f.distance*c->pixelSpread;
+   }
+   double ambient;
+   curShape->getPrimColor(f.color, &ambient, &f.opacity, &f.reflection, c, Ray(f.intersect, f.ray.vector), f.depth, prim, footprint);
 
-   Vector intersect = curTime*ray.vector+ray.point;
-   double opacity, reflection, ambient;
-   curShape->getColor(toFill, &ambient, &opacity, &reflection, c, Ray(intersect, ray.vector), depth);
-   
+   // OPTIM: one normal per hit serves both lighting and reflection
+   f.normal = curShape->getPrimNormal(f.intersect, prim);
    double lightData[3];
-   getLight(lightData, c, intersect, curShape->getNormal(intersect), curShape->reversible());
-   toFill[0] = (unsigned char)(toFill[0]*(ambient+lightData[0]*(1-ambient)));
-   toFill[1] = (unsigned char)(toFill[1]*(ambient+lightData[1]*(1-ambient)));
-   toFill[2] = (unsigned char)(toFill[2]*(ambient+lightData[2]*(1-ambient)));
-   if(depth<c->depth && (opacity<1-1e-6 || reflection>1e-6)){
-      unsigned char col[4];
-      if(opacity<1-1e-6){
-         Ray nextRay = Ray(intersect+ray.vector*1E-4, ray.vector);
-         calcColor(col, c, nextRay, depth+1);
-         toFill[0]= (unsigned char)(toFill[0]*opacity+col[0]*(1-opacity));
-         toFill[1]= (unsigned char)(toFill[1]*opacity+col[1]*(1-opacity));
-         toFill[2]= (unsigned char)(toFill[2]*opacity+col[2]*(1-opacity));        
+   getLight(lightData, c, f.intersect, f.normal, curShape->reversible(), curShape);
+   f.color[0] = (unsigned char)(f.color[0]*(ambient+lightData[0]*(1-ambient)));
+   f.color[1] = (unsigned char)(f.color[1]*(ambient+lightData[1]*(1-ambient)));
+   f.color[2] = (unsigned char)(f.color[2]*(ambient+lightData[2]*(1-ambient)));
+}
+
+// OPTIM: the transmitted / reflected ray tree is walked depth first on an
+// explicit per thread stack instead of by recursion, and a branch is never
+// traced once it can move the pixel by less than one level (RAY_MIN_WEIGHT).
+// A pruned branch is assumed to see the same color as its parent.
+void calcHitColor(unsigned char* toFill, Autonoma* c, Ray ray, Shape* curShape, double curTime, unsigned int prim, unsigned int depth) {
+   static thread_local RayFrame stack[MAX_RAY_DEPTH + 1];
+   if (depth == 0) STAT_INC(primaryRays);
+   const unsigned int maxDepth = (c->depth < depth + MAX_RAY_DEPTH) ? c->depth : depth + MAX_RAY_DEPTH;
+   int sp = 0;
+   stack[0].ray = ray;
+   stack[0].depth = depth;
+   stack[0].weight = 1.;
+   stack[0].distance = 0.;
+   shadeHit(stack[0], c, curShape, curTime, prim);
+
+   while (true) {
+      RayFrame& f = stack[sp];
+      if (f.phase == 2) {
+         if (sp == 0) break;
+         RayFrame& p = stack[--sp];
+         if (p.phase == 1) {
+            p.color[0]= (unsigned char)(p.color[0]*p.opacity+f.color[0]*(1-p.opacity));
+            p.color[1]= (unsigned char)(p.color[1]*p.opacity+f.color[1]*(1-p.opacity));
+            p.color[2]= (unsigned char)(p.color[2]*p.opacity+f.color[2]*(1-p.opacity));
+         } else {
+            p.color[0]= (unsigned char)(p.color[0]*(1-p.reflection)+f.color[0]*(p.reflection));
+            p.color[1]= (unsigned char)(p.color[1]*(1-p.reflection)+f.color[1]*(p.reflection));
+            p.color[2]= (unsigned char)(p.color[2]*(1-p.reflection)+f.color[2]*(p.reflection));
+         }
+         continue;
+      }
+
+      const bool transmit = f.phase == 0;
+      f.phase++;
+      if (f.depth >= maxDepth) continue;
+      double weight;
+      if (transmit) {
+         if (!(f.opacity<1-1e-6)) continue;
+         // The transmitted color is itself blended again under the reflection
+         weight = f.weight*(1-f.opacity)*((f.reflection>1e-6) ? 1-f.reflection : 1.);
+      } else {
+         if (!(f.reflection>1e-6)) continue;
+         weight = f.weight*f.reflection;
       }
-      if(reflection>1e-6){
-         Vector norm = curShape->getNormal(intersect).normalize();
-         Vector vec = ray.vector-2*norm*(norm.dot(ray.vector));
-         Ray nextRay = Ray(intersect+vec*1E-4, vec);
-         calcColor(col, c, nextRay, depth+1);
-      
-         toFill[0]= (unsigned char)(toFill[0]*(1-reflection)+col[0]*(reflection));
-         toFill[1]= (unsigned char)(toFill[1]*(1-reflection)+col[1]*(reflection));
-         toFill[2]= (unsigned char)(toFill[2]*(1-reflection)+col[2]*(reflection));
+      if (weight < RAY_MIN_WEIGHT) continue;
+
+      RayFrame& child = stack[++sp];
+      if (transmit) {
+         STAT_INC(transmissionRays);
+         child.ray = Ray(f.intersect+f.ray.vector*1E-4, f.ray.vector);
+      } else {
+         STAT_INC(reflectionRays);
+         Vector norm = f.normal.normalize();
+         Vector vec = f.ray.vector-2*norm*(norm.dot(f.ray.vector));
+         child.ray = Ray(f.intersect+vec*1E-4, vec);
       }
+      child.depth = f.depth+1;
+      child.distance = f.distance;
+      child.weight = weight;
+      double t;
+      unsigned int p;
+      Shape* s = c->bvh->intersect(child.ray, &t, &p);
+      shadeHit(child, c, s, t, p);
    }
-}
\ No newline at end of file
+
+   toFill[0] = stack[0].color[0];
+   toFill[1] = stack[0].color[1];
+   toFill[2] = stack[0].color[2];
+}
@@ -2,6 +2,15 @@
 #define __SHAPE_H__
 #include "light.h"
 
+// Deepest secondary ray the ray stack in calcHitColor can hold
+#define MAX_RAY_DEPTH 32
+// Branches of the ray tree weighing less than one color level are not traced
+#define RAY_MIN_WEIGHT (1./255)
+
+// OPTIM: concrete shape type, lets the traversal loops call it without the
+// vtable (see shapedispatch.h). SHAPE_OTHER always goes through the vtable.
+enum ShapeKind { SHAPE_OTHER, SHAPE_SPHERE, SHAPE_PLANE, SHAPE_TRIANGLE, SHAPE_MESH, SHAPE_DISK, SHAPE_BOX, SHAPE_INSTANCE };
+
 class Shape{
   public:
    Shape(const Vector &c, Texture* t, double ya, double pi, double ro);
@@ -14,14 +23,30 @@ class Shape{
    virtual bool getLightIntersection(Ray ray, double* fill) = 0;
    virtual void move() = 0;
    virtual unsigned char reversible() = 0;
-   virtual void getColor(unsigned char* toFill, double* am, double* op, double* ref, Autonoma* r, Ray ray, unsigned int depth) = 0;
+   // footprint is the world space width the sample covers (0 for a point
+   // sample), for picking the texture level
+   virtual void getColor(unsigned char* toFill, double* am, double* op, double* ref, Autonoma* r, Ray ray, unsigned int depth, double footprint) = 0;
    virtual Vector getNormal(Vector point) = 0;
    virtual void setAngles(double yaw, double pitch, double roll) = 0;
    virtual void setYaw(double d) = 0;
    virtual void setPitch(double d) = 0;
    virtual void setRoll(double d) = 0;
+   // OPTIM: world space bounding box for the BVH, false if unbounded
+   virtual bool getBounds(Vector& min, Vector& max);
+   virtual ShapeKind kind();
+   // Independent copy for another frame's scene (textures stay shared)
+   virtual Shape* clone() = 0;
+   // False if yaw / pitch / roll only turn the texture, not the surface
+   virtual bool rotationMovesSurface();
+   // Variants for shapes made of many faces (Mesh): the intersection reports
+   // which face (prim) was hit and shading gets it back. By default prim is
+   // always 0 and these forward to the plain versions.
+   virtual double getPrimIntersection(Ray ray, unsigned int* prim);
+   virtual void getPrimColor(unsigned char* toFill, double* am, double* op, double* ref, Autonoma* r, Ray ray, unsigned int depth, unsigned int prim, double footprint);
+   virtual Vector getPrimNormal(Vector point, unsigned int prim);
 };
 
-void calcColor(unsigned char* toFill, Autonoma*, Ray ray, unsigned int depth);
+// Shade a hit that was already found (shape NULL means the ray escaped)
+void calcHitColor(unsigned char* toFill, Autonoma*, Ray ray, Shape* shape, double time, unsigned int prim, unsigned int depth);
 
 #endif
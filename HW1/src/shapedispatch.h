@@ -0,0 +1,48 @@
+#ifndef __SHAPEDISPATCH_H__
+#define __SHAPEDISPATCH_H__
+#include "shape.h"
+#include "sphere.h"
+#include "plane.h"
+#include "triangle.h"
+#include "disk.h"
+#include "box.h"
+#include "mesh.h"
+#include "instance.h"
+#include "stats.h"
+
+// OPTIM: Shape calls for the traversal loops, switched on the kind cached next
+// to each prim. The qualified calls skip the vtable and can be inlined, and
+// since BVH leaves keep prims grouped by kind the switch predicts well.
+
+__attribute__((always_inline))
+inline double kindIntersection(Shape* s, unsigned char kind, const Ray& ray, unsigned int* prim) {
+   STAT_INC(shapeTests[kind]);
+   *prim = 0;
+   switch (kind) {
+   case SHAPE_SPHERE: return static_cast<Sphere*>(s)->Sphere::getIntersection(ray);
+   case SHAPE_PLANE: return static_cast<Plane*>(s)->Plane::getIntersection(ray);
+   case SHAPE_TRIANGLE: return static_cast<Triangle*>(s)->Triangle::getIntersection(ray);
+   case SHAPE_DISK: return static_cast<Disk*>(s)->Disk::getIntersection(ray);
+   case SHAPE_BOX: return static_cast<Box*>(s)->Box::getIntersection(ray);
+   case SHAPE_MESH: return static_cast<Mesh*>(s)->Mesh::getPrimIntersection(ray, prim);
+   case SHAPE_INSTANCE: return static_cast<Instance*>(s)->Instance::getPrimIntersection(ray, prim);
+   default: return s->getPrimIntersection(ray, prim);
+   }
+}
+
+__attribute__((always_inline))
+inline bool kindLightIntersection(Shape* s, unsigned char kind, const Ray& ray, double* fill) {
+   STAT_INC(shapeTests[kind]);
+   switch (kind) {
+   case SHAPE_SPHERE: return static_cast<Sphere*>(s)->Sphere::getLightIntersection(ray, fill);
+   case SHAPE_PLANE: return static_cast<Plane*>(s)->Plane::getLightIntersection(ray, fill);
+   case SHAPE_TRIANGLE: return static_cast<Triangle*>(s)->Triangle::getLightIntersection(ray, fill);
+   case SHAPE_DISK: return static_cast<Disk*>(s)->Disk::getLightIntersection(ray, fill);
+   case SHAPE_BOX: return static_cast<Box*>(s)->Box::getLightIntersection(ray, fill);
+   case SHAPE_MESH: return static_cast<Mesh*>(s)->Mesh::getLightIntersection(ray, fill);
+   case SHAPE_INSTANCE: return static_cast<Instance*>(s)->Instance::getLightIntersection(ray, fill);
+   default: return s->getLightIntersection(ray, fill);
+   }
+}
+
+#endif
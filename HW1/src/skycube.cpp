@@ -0,0 +1,53 @@
+#include "skycube.h"
+#include "stats.h"
+
+SkyCube::SkyCube(Texture* sky, unsigned int s) : size(s) {
+   faces = (unsigned char*)malloc(6*size*size*3*sizeof(unsigned char));
+   for (int face = 0; face<6; face++)
+      for (unsigned int j = 0; j<size; j++)
+         for (unsigned int i = 0; i<size; i++) {
+            // Inverse of the face selection in getColor
+            const double a = 2*(i+.5)/size-1, b = 2*(j+.5)/size-1;
+            const double sign = (face&1) ? -1 : 1;
+            Vector dir(0, 0, 0);
+            switch (face>>1) {
+               case 0: dir = Vector(sign, b, a); break;
+               case 1: dir = Vector(a, sign, b); break;
+               default: dir = Vector(b, a, sign); break;
+            }
+            // Same mapping the tracer used per ray
+            Vector temp = dir.normalize();
+            const double me = (temp.y<0)?-temp.y:temp.y;
+            const double angle = atan2(temp.z, temp.x);
+            double am, op, ref;
+            sky->getColor(&faces[3*((face*size+j)*size+i)], &am, &op, &ref, fix(angle/M_TWO_PI), fix(me));
+         }
+}
+
+SkyCube::~SkyCube() {
+   free(faces);
+}
+
+void SkyCube::getColor(unsigned char* toFill, const Vector& dir) const {
+   STAT_INC(textureSamples);
+   const double ax = (dir.x<0)?-dir.x:dir.x;
+   const double ay = (dir.y<0)?-dir.y:dir.y;
+   const double az = (dir.z<0)?-dir.z:dir.z;
+   int face;
+   double major, a, b;
+   if (ax >= ay && ax >= az) {
+      face = (dir.x<0) ? 1 : 0; major = ax; a = dir.z; b = dir.y;
+   } else if (ay >= az) {
+      face = (dir.y<0) ? 3 : 2; major = ay; a = dir.x; b = dir.z;
+   } else {
+      face = (dir.z<0) ? 5 : 4; major = az; a = dir.y; b = dir.x;
+   }
+   const double scale = .5*size/major;
+   int i = (int)((a+major)*scale), j = (int)((b+major)*scale);
+   if (i >= (int)size) i = size-1;
+   if (j >= (int)size) j = size-1;
+   const unsigned char* p = &faces[3*((face*size+j)*size+i)];
+   toFill[0] = p[0];
+   toFill[1] = p[1];
+   toFill[2] = p[2];
+}
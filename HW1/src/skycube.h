@@ -0,0 +1,25 @@
+#ifndef __SKYCUBE_H__
+#define __SKYCUBE_H__
+#include "vector.h"
+#include "Textures/texture.h"
+
+// Largest face size built, 6 faces of 1024x1024 RGB are 18 MiB
+#define SKY_CUBE_MAX 1024
+
+// OPTIM: The skybox resampled once onto the six faces of a cube, so a ray
+// that misses everything picks its texel with compares and two divides
+// instead of a normalize and an atan2. Each texel holds the skybox color
+// in the texel center's direction (nearest lookups on both sides).
+class SkyCube {
+public:
+   SkyCube(Texture* sky, unsigned int size);
+   ~SkyCube();
+   // Color of the skybox seen along dir, which needs not be normalized
+   void getColor(unsigned char* toFill, const Vector& dir) const;
+private:
+   unsigned int size;
+   // Six size x size RGB faces, +x -x +y -y +z -z
+   unsigned char* faces;
+};
+
+#endif
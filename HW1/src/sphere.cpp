@@ -115,10 +115,15 @@ void Sphere::move(){
 }
 unsigned char Sphere::reversible(){return 0;}
 
-void Sphere::getColor(unsigned char* toFill, double* amb, double* op, double* ref, Autonoma* r, Ray ray, unsigned int depth){
+void Sphere::getColor(unsigned char* toFill, double* amb, double* op, double* ref, Autonoma* r, Ray ray, unsigned int depth, double footprint){
    double data3 = (center.y-ray.point.y+radius)/(2*radius);
    double data2 = atan2( ray.point.z-center.z, ray.point.x-center.x);
-   texture->getColor(toFill, amb, op, ref,fix((yaw+data2)/M_TWO_PI/textureX),fix((pitch/M_TWO_PI-(data3))/textureY));
+   // The texture wraps once around the equator and once pole to pole
+   if (footprint > 0) {
+      const double around = M_TWO_PI*radius*fabs(textureX), down = 2*radius*fabs(textureY);
+      footprint /= (around<down) ? around : down;
+   }
+   texture->getFilteredColor(toFill, amb, op, ref,fix((yaw+data2)/M_TWO_PI/textureX),fix((pitch/M_TWO_PI-(data3))/textureY), footprint);
 }
 Vector Sphere::getNormal(Vector point){
    Vector vect = point-center;
@@ -178,4 +183,22 @@ void Sphere::setRoll(double c){
    roll = c;
    zcos = cos(roll);
    zsin = sin(roll);
+}
+
+ShapeKind Sphere::kind(){
+   return SHAPE_SPHERE;
+}
+
+Shape* Sphere::clone(){
+   return new Sphere(*this);
+}
+
+bool Sphere::rotationMovesSurface(){
+   return false;
+}
+
+bool Sphere::getBounds(Vector& min, Vector& max){
+   min = min_v;
+   max = max_v;
+   return true;
 }
\ No newline at end of file
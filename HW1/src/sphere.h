@@ -10,12 +10,16 @@ public:
   double getIntersection(Ray ray);
   void move();
   bool getLightIntersection(Ray ray, double* fill);
-  void getColor(unsigned char* toFill, double* am, double* op, double* ref, Autonoma* r, Ray ray, unsigned int depth);
+  void getColor(unsigned char* toFill, double* am, double* op, double* ref, Autonoma* r, Ray ray, unsigned int depth, double footprint);
   Vector getNormal(Vector point);
   unsigned char reversible();
   void setAngles(double a, double b, double c);
   void setYaw(double a);
   void setPitch(double b);
   void setRoll(double c);
+  bool getBounds(Vector& min, Vector& max);
+  ShapeKind kind();
+  Shape* clone();
+  bool rotationMovesSurface();
 };
 #endif
\ No newline at end of file
@@ -0,0 +1,90 @@
+#include "stats.h"
+#include "shape.h"
+#include <mutex>
+#include <string.h>
+
+static_assert(SHAPE_INSTANCE < STAT_KINDS, "STAT_KINDS must cover every ShapeKind");
+
+#ifdef RAY_STATS
+thread_local RayStats threadStats;
+#endif
+
+static std::mutex statsLock;
+
+void flushStats(RayStats* total) {
+#ifdef RAY_STATS
+   const RayStats& s = threadStats;
+   {
+      std::lock_guard<std::mutex> guard(statsLock);
+      total->primaryRays += s.primaryRays;
+      total->shadowRays += s.shadowRays;
+      total->shadowCacheHits += s.shadowCacheHits;
+      total->reflectionRays += s.reflectionRays;
+      total->transmissionRays += s.transmissionRays;
+      total->nodeTests += s.nodeTests;
+      total->nodeRejections += s.nodeRejections;
+      for (int k = 0; k < STAT_KINDS; k++) {
+         total->shapeTests[k] += s.shapeTests[k];
+         total->leafRejections[k] += s.leafRejections[k];
+      }
+      total->meshNodeTests += s.meshNodeTests;
+      total->meshNodeRejections += s.meshNodeRejections;
+      total->faceTests += s.faceTests;
+      total->textureSamples += s.textureSamples;
+      total->shadedRays += s.shadedRays;
+      total->depthSum += s.depthSum;
+      if (s.maxDepth > total->maxDepth) total->maxDepth = s.maxDepth;
+   }
+   memset(&threadStats, 0, sizeof(RayStats));
+#endif
+}
+
+// s as the body of a JSON string
+static void writeJSONString(FILE* f, const char* s) {
+   for (; *s; s++) {
+      const unsigned char c = *s;
+      if (c == '"' || c == '\\') fprintf(f, "\\%c", c);
+      else if (c < 0x20) fprintf(f, "\\u%04x", c);
+      else fputc(c, f);
+   }
+}
+
+void writeStatsHeader(FILE* f, const char* scene, int w, int h, int frames, double parse) {
+#ifdef RAY_STATS
+   const char* counters = "true";
+#else
+   const char* counters = "false";
+#endif
+   fprintf(f, "{\"scene\":\"");
+   writeJSONString(f, scene ? scene : "");
+   fprintf(f, "\",\"width\":%d,\"height\":%d,\"frames\":%d,\"counters\":%s,\"seconds\":{\"parse\":%.6f}}\n",
+           w, h, frames, counters, parse);
+   fflush(f);
+}
+
+void writeFrameStats(FILE* f, int frame, const FrameStats& s) {
+   fprintf(f, "{\"frame\":%d,\"seconds\":{\"setFrame\":%.6f,\"refresh\":%.6f,\"output\":%.6f},\"rays\":{\"camera\":%llu",
+           frame, s.setFrame, s.refresh, s.output, s.cameraRays);
+#ifdef RAY_STATS
+   static const char* const kindNames[STAT_KINDS] = {"other", "sphere", "plane", "triangle", "mesh", "disk", "box", "instance"};
+   const RayStats& c = s.counters;
+   fprintf(f, ",\"primary\":%llu,\"shadow\":%llu,\"shadow_cache_hits\":%llu,\"reflection\":%llu,\"transmission\":%llu}",
+           c.primaryRays, c.shadowRays, c.shadowCacheHits, c.reflectionRays, c.transmissionRays);
+   fprintf(f, ",\"bvh\":{\"node_tests\":%llu,\"node_rejections\":%llu}", c.nodeTests, c.nodeRejections);
+   fprintf(f, ",\"shapes\":{");
+   bool first = true;
+   for (int k = 0; k < STAT_KINDS; k++) {
+      if (!c.shapeTests[k] && !c.leafRejections[k]) continue;
+      fprintf(f, "%s\"%s\":{\"tests\":%llu,\"leaf_rejections\":%llu}", first ? "" : ",", kindNames[k], c.shapeTests[k], c.leafRejections[k]);
+      first = false;
+   }
+   fprintf(f, "},\"mesh\":{\"node_tests\":%llu,\"node_rejections\":%llu,\"face_tests\":%llu}",
+           c.meshNodeTests, c.meshNodeRejections, c.faceTests);
+   fprintf(f, ",\"texture_samples\":%llu,\"depth\":{\"average\":%.4f,\"max\":%llu}",
+           c.textureSamples, c.shadedRays ? (double)c.depthSum / c.shadedRays : 0., c.maxDepth);
+#else
+   fprintf(f, "}");
+#endif
+   fprintf(f, "}\n");
+   fflush(f);
+}
@@ -0,0 +1,54 @@
+#ifndef __STATS_H__
+#define __STATS_H__
+#include <stdio.h>
+
+// Render counters, built in with make STATS=1 (-DRAY_STATS) and free
+// otherwise. Each thread counts into its own threadStats, which the render
+// passes merge into the frame's totals with flushStats once they finish.
+
+// Slots for the per kind counters, indexed by ShapeKind
+#define STAT_KINDS 8
+
+struct RayStats {
+   // Camera rays shaded (cached hits included), shadow rays actually traced
+   // (shadow cache hits are counted apart) and the secondary rays
+   unsigned long long primaryRays, shadowRays, shadowCacheHits, reflectionRays, transmissionRays;
+   // Scene BVH boxes tested and missed
+   unsigned long long nodeTests, nodeRejections;
+   // Intersection tests per shape kind, and shapes never tested because
+   // the box of their BVH leaf was missed
+   unsigned long long shapeTests[STAT_KINDS], leafRejections[STAT_KINDS];
+   // Boxes and faces of the mesh BVHs
+   unsigned long long meshNodeTests, meshNodeRejections, faceTests;
+   unsigned long long textureSamples;
+   // Rays shaded, with their summed and deepest recursion depth
+   unsigned long long shadedRays, depthSum, maxDepth;
+};
+
+#ifdef RAY_STATS
+extern thread_local RayStats threadStats;
+#define STAT_ADD(field, n) (threadStats.field += (n))
+#else
+#define STAT_ADD(field, n) ((void)0)
+#endif
+#define STAT_INC(field) STAT_ADD(field, 1)
+
+// Adds this thread's counters to *total and zeroes them, thread safe
+void flushStats(RayStats* total);
+
+// Per frame record for --stats
+struct FrameStats {
+   // setFrame as a whole, and the refresh inside it, in seconds
+   double setFrame, refresh;
+   // Time the writer thread spent writing the frame
+   double output;
+   // Camera rays traced by refresh, the --aa ones included
+   unsigned long long cameraRays;
+   RayStats counters;
+};
+
+// One JSON object on one line per call
+void writeStatsHeader(FILE* f, const char* scene, int w, int h, int frames, double parse);
+void writeFrameStats(FILE* f, int frame, const FrameStats& s);
+
+#endif
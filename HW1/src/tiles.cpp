@@ -0,0 +1,55 @@
+#include "tiles.h"
+
+static inline unsigned long long pack(unsigned int begin, unsigned int end) {
+   return ((unsigned long long)begin << 32) | end;
+}
+
+TileScheduler::TileScheduler(int workers) : numWorkers(workers) {
+   queues = new Range[numWorkers];
+   reset(0);
+}
+
+void TileScheduler::reset(int numTiles) {
+   for (int w = 0; w < numWorkers; w++) {
+      const unsigned int begin = (unsigned long long)numTiles * w / numWorkers;
+      const unsigned int end = (unsigned long long)numTiles * (w + 1) / numWorkers;
+      queues[w].bounds.store(pack(begin, end), std::memory_order_relaxed);
+   }
+}
+
+TileScheduler::~TileScheduler() {
+   delete[] queues;
+}
+
+int TileScheduler::next(int worker) {
+   std::atomic<unsigned long long>& own = queues[worker].bounds;
+   while (true) {
+      unsigned long long r = own.load(std::memory_order_relaxed);
+      const unsigned int begin = r >> 32, end = (unsigned int)r;
+      if (begin < end) {
+         if (own.compare_exchange_weak(r, pack(begin + 1, end), std::memory_order_relaxed))
+            return begin;
+         continue;
+      }
+      if (!steal(worker)) return -1;
+   }
+}
+
+// Move the back half of some other worker's block into our (empty) queue.
+// Only the owner ever stores into its own queue; everyone else uses CAS.
+bool TileScheduler::steal(int worker) {
+   for (int i = 1; i < numWorkers; i++) {
+      std::atomic<unsigned long long>& victim = queues[(worker + i) % numWorkers].bounds;
+      unsigned long long r = victim.load(std::memory_order_relaxed);
+      while (true) {
+         const unsigned int begin = r >> 32, end = (unsigned int)r;
+         if (begin >= end) break;
+         const unsigned int mid = begin + (end - begin) / 2;
+         if (victim.compare_exchange_weak(r, pack(begin, mid), std::memory_order_relaxed)) {
+            queues[worker].bounds.store(pack(mid, end), std::memory_order_relaxed);
+            return true;
+         }
+      }
+   }
+   return false;
+}
@@ -0,0 +1,28 @@
+#ifndef __TILES_H__
+#define __TILES_H__
+#include <atomic>
+
+// OPTIM: Work-stealing distribution of screen tiles. Every worker starts with
+// a contiguous block of tiles (good locality) and, once it runs dry, steals
+// the back half of another worker's remaining block.
+#define TILE_SIZE 16
+
+class TileScheduler {
+public:
+   TileScheduler(int numWorkers);
+   ~TileScheduler();
+   // Deal out numTiles fresh tiles, must not race with next()
+   void reset(int numTiles);
+   // Next tile for this worker, or -1 once every tile has been handed out
+   int next(int worker);
+private:
+   // [begin, end) packed as begin << 32 | end so both move with one CAS
+   struct alignas(64) Range {
+      std::atomic<unsigned long long> bounds;
+   };
+   Range* queues;
+   int numWorkers;
+   bool steal(int worker);
+};
+
+#endif
@@ -99,4 +99,18 @@ bool Triangle::getLightIntersection(Ray ray, double* fill){
    fill[1]*=temp[1] * over255;
    fill[2]*=temp[2] * over255;
    return false;
+}
+
+bool Triangle::getBounds(Vector& min, Vector& max){
+   min = min_v;
+   max = max_v;
+   return true;
+}
+
+ShapeKind Triangle::kind(){
+   return SHAPE_TRIANGLE;
+}
+
+Shape* Triangle::clone(){
+   return new Triangle(*this);
 }
\ No newline at end of file
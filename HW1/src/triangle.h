@@ -9,6 +9,9 @@ public:
    Triangle(Vector c, Vector b, Vector a, Texture* t);
    double getIntersection(Ray ray);
    bool getLightIntersection(Ray ray, double* fill);
+   bool getBounds(Vector& min, Vector& max);
+   ShapeKind kind();
+   Shape* clone();
 };
 
 #endif
\ No newline at end of file
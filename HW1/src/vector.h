@@ -8,73 +8,95 @@
 #include<limits>
 constexpr double inf = std::numeric_limits<double>::infinity();
 
-class Vector{
+// OPTIM: scalar type of Vector / Ray, double unless built with -DRAY_FLOAT
+// (make FLOAT=1)
+#ifdef RAY_FLOAT
+typedef float real;
+#else
+typedef double real;
+#endif
+
+// OPTIM: header only so every operator inlines at its call site. Float
+// vectors are padded to 16 bytes so one fills an SSE register.
+template<typename T>
+class alignas(sizeof(T) == 4 ? 16 : alignof(T)) vec3{
 public:
-  double x, y, z;
-  Vector(double a, double b, double c);
-  
-  
-  void operator +=(const Vector);
-  void operator -= (const Vector);
-  void operator *= (const double);
-  void operator *= (const float);
-  void operator *= (const int);
-  void operator /= (const double);
-  void operator /= (const float);
-  void operator /= (const int);
-  
-  Vector operator + (const Vector);
-  Vector operator - (const Vector);
-/*  Vector operator * (const Vector);*/
-  Vector operator * (const double);
-  Vector operator * (const float);
-  Vector operator * (const int);
-  Vector operator / (const double);
-  Vector operator / (const float);
-  Vector operator / (const int);
-  Vector cross(const Vector a);
-  double mag2();
-  double mag();
-  double dot(const Vector a);
-  Vector normalize();
+  T x, y, z;
+  vec3(T a, T b, T c) : x(a), y(b), z(c) {}
+
+  void operator +=(const vec3 rhs){ x+=rhs.x; y+=rhs.y; z+=rhs.z; }
+  void operator -= (const vec3 rhs){ x-=rhs.x; y-=rhs.y; z-=rhs.z; }
+  void operator *= (const double rhs){ x*=rhs; y*=rhs; z*=rhs; }
+  void operator *= (const float rhs){ x*=rhs; y*=rhs; z*=rhs; }
+  void operator *= (const int rhs){ x*=rhs; y*=rhs; z*=rhs; }
+  void operator /= (const double rhs){ x/=rhs; y/=rhs; z/=rhs; }
+  void operator /= (const float rhs){ x/=rhs; y/=rhs; z/=rhs; }
+  void operator /= (const int rhs){ x/=rhs; y/=rhs; z/=rhs; }
+
+  vec3 operator + (const vec3 rhs) const { return vec3(x+rhs.x, y+rhs.y, z+rhs.z); }
+  vec3 operator - (const vec3 rhs) const { return vec3(x-rhs.x, y-rhs.y, z-rhs.z); }
+  vec3 operator * (const double rhs) const { return vec3(x*rhs, y*rhs, z*rhs); }
+  vec3 operator * (const float rhs) const { return vec3(x*rhs, y*rhs, z*rhs); }
+  vec3 operator * (const int rhs) const { return vec3(x*rhs, y*rhs, z*rhs); }
+  vec3 operator / (const double rhs) const { return vec3(x/rhs, y/rhs, z/rhs); }
+  vec3 operator / (const float rhs) const { return vec3(x/rhs, y/rhs, z/rhs); }
+  vec3 operator / (const int rhs) const { return vec3(x/rhs, y/rhs, z/rhs); }
+  vec3 cross(const vec3 a) const { return vec3(y*a.z-z*a.y, z*a.x-x*a.z, x*a.y-y*a.x); }
+  T mag2() const { return x*x+y*y+z*z; }
+  T mag() const { return sqrt(x*x+y*y+z*z); }
+  T dot(const vec3 a) const { return x*a.x+y*a.y+z*a.z; }
+  vec3 normalize() const {
+   T m = mag();
+   return vec3(x/m, y/m, z/m);
+  }
 } ;
 
+typedef vec3<real> Vector;
+
 class Ray{
 public:
   Vector point, vector;
-  Ray(const Vector& po, const Vector& ve);
+  Ray(const Vector& po, const Vector& ve) : point(po), vector(ve) {}
 };
 
-  inline Vector operator-(const Vector b){
-   return Vector(-b.x,-b.y,-b.z);
+  template<typename T>
+  inline vec3<T> operator-(const vec3<T> b){
+   return vec3<T>(-b.x,-b.y,-b.z);
   }
   
-  inline Vector operator+(const Vector b){
+  template<typename T>
+  inline vec3<T> operator+(const vec3<T> b){
    return b;
   }
   
-  inline Vector operator*(const int a, const Vector b){
-   return Vector(a*b.x,a*b.y,a*b.z);
+  template<typename T>
+  inline vec3<T> operator*(const int a, const vec3<T> b){
+   return vec3<T>(a*b.x,a*b.y,a*b.z);
   }
 
-  inline Vector operator*(const double a, const Vector b){
-   return Vector(a*b.x,a*b.y,a*b.z);
+  template<typename T>
+  inline vec3<T> operator*(const double a, const vec3<T> b){
+   return vec3<T>(a*b.x,a*b.y,a*b.z);
   }
 
-  inline Vector operator*(const float a, const Vector b){
-   return Vector(a*b.x,a*b.y,a*b.z);
+  template<typename T>
+  inline vec3<T> operator*(const float a, const vec3<T> b){
+   return vec3<T>(a*b.x,a*b.y,a*b.z);
   }
 
-  inline Vector operator/(const int a, const Vector b){
-   return Vector(a/b.x,a/b.y,a/b.z);
+  template<typename T>
+  inline vec3<T> operator/(const int a, const vec3<T> b){
+   return vec3<T>(a/b.x,a/b.y,a/b.z);
   }
 
-  inline Vector operator/(const double a, const Vector b){
-   return Vector(a/b.x,a/b.y,a/b.z);
+  template<typename T>
+  inline vec3<T> operator/(const double a, const vec3<T> b){
+   return vec3<T>(a/b.x,a/b.y,a/b.z);
   }
 
-  inline Vector operator/(const float a, const Vector b){
-   return Vector(a/b.x,a/b.y,a/b.z);
+  template<typename T>
+  inline vec3<T> operator/(const float a, const vec3<T> b){
+   return vec3<T>(a/b.x,a/b.y,a/b.z);
   }
   
   Vector solveScalers(Vector v1, Vector v2, Vector v3, Vector solve);